@@ -0,0 +1,70 @@
+#include "fence.h"
+
+#include "core/futex.h"
+#include "core/mem.h"
+
+#include <limits.h>
+#include <stdatomic.h>
+
+// checks this many times before sleeping
+#define WAIT_SPIN_COUNT 1024
+
+struct fence {
+    // 1 once signaled. futex word
+    atomic_uint signaled;
+    atomic_uint waiters;
+};
+
+fence_t* fence_create(bool signaled) {
+    fence_t* fence = mem_alloc(sizeof(fence_t));
+
+    atomic_init(&fence->signaled, signaled ? 1 : 0);
+    atomic_init(&fence->waiters, 0);
+
+    return fence;
+}
+
+void fence_destroy(fence_t* fence) {
+    if (!fence) {
+        return;
+    }
+
+    mem_free(fence);
+}
+
+void fence_signal(fence_t* fence) {
+    atomic_store_explicit(&fence->signaled, 1, memory_order_seq_cst);
+
+    // pairs with the waiter registering itself before checking one last time
+    if (atomic_load_explicit(&fence->waiters, memory_order_seq_cst) > 0) {
+        futex_wake(&fence->signaled, INT_MAX);
+    }
+}
+
+void fence_reset(fence_t* fence) {
+    atomic_store_explicit(&fence->signaled, 0, memory_order_relaxed);
+}
+
+bool fence_is_signaled(const fence_t* fence) {
+    return atomic_load_explicit(&fence->signaled, memory_order_acquire) != 0;
+}
+
+void fence_wait(fence_t* fence) {
+    for (uint32_t i = 0; i < WAIT_SPIN_COUNT; i++) {
+        if (fence_is_signaled(fence)) {
+            return;
+        }
+
+        cpu_relax();
+    }
+
+    while (atomic_load_explicit(&fence->signaled, memory_order_seq_cst) == 0) {
+        atomic_fetch_add_explicit(&fence->waiters, 1, memory_order_seq_cst);
+
+        if (atomic_load_explicit(&fence->signaled, memory_order_seq_cst) == 0) {
+            futex_wait(&fence->signaled, 0);
+        }
+
+        atomic_fetch_sub_explicit(&fence->waiters, 1, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef FENCE_H_
+#define FENCE_H_
+
+#include <stdbool.h>
+
+// one-shot event. once signaled, every wait returns until it is reset
+typedef struct fence fence_t;
+
+fence_t* fence_create(bool signaled);
+
+// the signaling thread may still be touching the fence right after a wait returns, so make sure
+// it is done before destroying it, e.g. with rasterizer_wait_idle
+void fence_destroy(fence_t* fence);
+
+void fence_signal(fence_t* fence);
+
+// not safe while anyone may still signal the fence
+void fence_reset(fence_t* fence);
+
+bool fence_is_signaled(const fence_t* fence);
+
+// spins for a short while before going to sleep, like the join of thread_worker_parallel_for
+void fence_wait(fence_t* fence);
+
+#endif
@@ -0,0 +1,28 @@
+#include "futex.h"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <sched.h>
+#endif
+
+_Static_assert(sizeof(atomic_uint) == sizeof(uint32_t), "futex words are 32 bits");
+
+void futex_wait(atomic_uint* address, uint32_t expected) {
+#ifdef __linux__
+    syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+#else
+    // no futex, so the best we can do is get out of the way
+    if (atomic_load_explicit(address, memory_order_relaxed) == expected) {
+        sched_yield();
+    }
+#endif
+}
+
+void futex_wake(atomic_uint* address, uint32_t count) {
+#ifdef __linux__
+    syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#endif
+}
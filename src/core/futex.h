@@ -0,0 +1,22 @@
+#ifndef FUTEX_H_
+#define FUTEX_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// blocks while *address is equal to expected. may return spuriously, so always check again
+void futex_wait(atomic_uint* address, uint32_t expected);
+
+// wakes up to count threads waiting on address
+void futex_wake(atomic_uint* address, uint32_t count);
+
+// for spin loops, before giving up and waiting
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+#endif
@@ -1,24 +1,304 @@
 #include "mem.h"
 
 #include <malloc.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 
-void* mem_alloc(size_t size) {
-    // todo: log?
-    return malloc(size);
+static _Thread_local mem_tag s_thread_tag = MEM_TAG_GENERAL;
+
+mem_tag mem_set_thread_tag(mem_tag tag) {
+    mem_tag previous = s_thread_tag;
+    s_thread_tag = tag;
+
+    return previous;
+}
+
+const char* mem_tag_name(mem_tag tag) {
+    switch (tag) {
+    case MEM_TAG_GENERAL:
+        return "General";
+    case MEM_TAG_RASTERIZER:
+        return "Rasterizer";
+    case MEM_TAG_CAPTURE:
+        return "Capture";
+    case MEM_TAG_IMGUI:
+        return "ImGui";
+    case MEM_TAG_SDL:
+        return "SDL";
+    default:
+        return "Unknown";
+    }
+}
+
+#ifdef MEM_TRACKING
+
+struct mem_tag_counters {
+    atomic_size_t live_bytes, peak_bytes;
+    atomic_uint_fast64_t allocations, frees;
+
+    atomic_uint_fast64_t frame_allocations;
+    atomic_size_t frame_bytes;
+
+    // snapshot of the frame counters
+    uint64_t last_frame_allocations;
+    size_t last_frame_bytes;
+};
+
+// every tracked block is preceded by this, so that frees know what to account for
+union mem_header {
+    struct {
+        size_t size;
+        mem_tag tag;
+    };
+
+    max_align_t alignment;
+};
+
+static struct mem_tag_counters s_counters[MEM_TAG_COUNT];
+
+static void mem_track_alloc(size_t size, mem_tag tag) {
+    struct mem_tag_counters* counters = &s_counters[tag];
+
+    size_t live = atomic_fetch_add_explicit(&counters->live_bytes, size, memory_order_relaxed);
+    live += size;
+
+    size_t peak = atomic_load_explicit(&counters->peak_bytes, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak_explicit(&counters->peak_bytes, &peak,
+                                                                 live, memory_order_relaxed,
+                                                                 memory_order_relaxed)) {
+    }
+
+    atomic_fetch_add_explicit(&counters->allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->frame_allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->frame_bytes, size, memory_order_relaxed);
+}
+
+static void mem_track_free(size_t size, mem_tag tag) {
+    struct mem_tag_counters* counters = &s_counters[tag];
+
+    atomic_fetch_sub_explicit(&counters->live_bytes, size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->frees, 1, memory_order_relaxed);
+}
+
+static void* mem_finish_block(union mem_header* header, size_t size, mem_tag tag) {
+    if (!header) {
+        return NULL;
+    }
+
+    header->size = size;
+    header->tag = tag;
+    mem_track_alloc(size, tag);
+
+    return header + 1;
+}
+
+void* mem_alloc_tagged(size_t size, mem_tag tag) {
+    union mem_header* header = malloc(sizeof(union mem_header) + size);
+    return mem_finish_block(header, size, tag);
+}
+
+void* mem_calloc_tagged(size_t nmemb, size_t size, mem_tag tag) {
+    size_t total_size = nmemb * size;
+    if (size > 0 && total_size / size != nmemb) {
+        return NULL;
+    }
+
+    union mem_header* header = calloc(1, sizeof(union mem_header) + total_size);
+    return mem_finish_block(header, total_size, tag);
+}
+
+void* mem_realloc_tagged(void* mem, size_t size, mem_tag tag) {
+    if (!mem) {
+        return mem_alloc_tagged(size, tag);
+    }
+
+    union mem_header* header = (union mem_header*)mem - 1;
+    size_t old_size = header->size;
+    mem_tag old_tag = header->tag;
+
+    header = realloc(header, sizeof(union mem_header) + size);
+    if (!header) {
+        return NULL;
+    }
+
+    // the block stays with whoever allocated it first
+    mem_track_free(old_size, old_tag);
+    return mem_finish_block(header, size, old_tag);
+}
+
+void mem_free(void* block) {
+    if (!block) {
+        return;
+    }
+
+    union mem_header* header = (union mem_header*)block - 1;
+    mem_track_free(header->size, header->tag);
+
+    free(header);
+}
+
+bool mem_get_tag_stats(mem_tag tag, struct mem_tag_stats* stats) {
+    const struct mem_tag_counters* counters = &s_counters[tag];
+
+    stats->live_bytes = atomic_load_explicit(&counters->live_bytes, memory_order_relaxed);
+    stats->peak_bytes = atomic_load_explicit(&counters->peak_bytes, memory_order_relaxed);
+    stats->allocations = atomic_load_explicit(&counters->allocations, memory_order_relaxed);
+    stats->frees = atomic_load_explicit(&counters->frees, memory_order_relaxed);
+
+    stats->frame_allocations = counters->last_frame_allocations;
+    stats->frame_bytes = counters->last_frame_bytes;
+
+    return true;
+}
+
+void mem_end_frame() {
+    for (uint32_t i = 0; i < MEM_TAG_COUNT; i++) {
+        struct mem_tag_counters* counters = &s_counters[i];
+
+        counters->last_frame_allocations =
+            atomic_exchange_explicit(&counters->frame_allocations, 0, memory_order_relaxed);
+
+        counters->last_frame_bytes =
+            atomic_exchange_explicit(&counters->frame_bytes, 0, memory_order_relaxed);
+    }
 }
 
-void* mem_calloc(size_t nmemb, size_t size) {
-    // todo: log?
+#else
+
+void* mem_alloc_tagged(size_t size, mem_tag tag) {
+    (void)tag;
+    return malloc(size);
+}
 
+void* mem_calloc_tagged(size_t nmemb, size_t size, mem_tag tag) {
+    (void)tag;
     return calloc(nmemb, size);
 }
 
-void* mem_realloc(void* mem, size_t size) {
-    // todo: log?
+void* mem_realloc_tagged(void* mem, size_t size, mem_tag tag) {
+    (void)tag;
     return realloc(mem, size);
 }
 
-void mem_free(void* block) {
-    // todo: log?
-    return free(block);
+void mem_free(void* block) { free(block); }
+
+bool mem_get_tag_stats(mem_tag tag, struct mem_tag_stats* stats) {
+    (void)tag;
+    (void)stats;
+
+    return false;
+}
+
+void mem_end_frame() {}
+
+#endif
+
+void* mem_alloc(size_t size) { return mem_alloc_tagged(size, s_thread_tag); }
+
+void* mem_calloc(size_t nmemb, size_t size) { return mem_calloc_tagged(nmemb, size, s_thread_tag); }
+
+void* mem_realloc(void* mem, size_t size) { return mem_realloc_tagged(mem, size, s_thread_tag); }
+
+struct mem_arena_block {
+    struct mem_arena_block* next;
+    size_t size, used;
+
+    alignas(max_align_t) uint8_t data[];
+};
+
+struct mem_arena {
+    // blocks past the current one are empty, and get reused before allocating new ones
+    struct mem_arena_block* first;
+    struct mem_arena_block* current;
+
+    size_t block_size;
+};
+
+static struct mem_arena_block* mem_arena_block_create(size_t size) {
+    struct mem_arena_block* block = mem_alloc(sizeof(struct mem_arena_block) + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+static void mem_arena_free_blocks(struct mem_arena_block* block) {
+    while (block) {
+        struct mem_arena_block* next = block->next;
+        mem_free(block);
+
+        block = next;
+    }
+}
+
+mem_arena_t* mem_arena_create(size_t block_size) {
+    mem_arena_t* arena = mem_alloc(sizeof(mem_arena_t));
+    arena->block_size = block_size;
+
+    arena->first = mem_arena_block_create(block_size);
+    arena->current = arena->first;
+
+    return arena;
+}
+
+void mem_arena_destroy(mem_arena_t* arena) {
+    if (!arena) {
+        return;
+    }
+
+    mem_arena_free_blocks(arena->first);
+    mem_free(arena);
+}
+
+void* mem_arena_alloc(mem_arena_t* arena, size_t size) {
+    struct mem_arena_block* block = arena->current;
+
+    size_t alignment = alignof(max_align_t);
+    size_t offset = (block->used + alignment - 1) / alignment * alignment;
+
+    while (offset + size > block->size) {
+        if (!block->next) {
+            size_t block_size = size > arena->block_size ? size : arena->block_size;
+            block->next = mem_arena_block_create(block_size);
+        }
+
+        block = block->next;
+        block->used = 0;
+        offset = 0;
+    }
+
+    block->used = offset + size;
+    arena->current = block;
+
+    return block->data + offset;
+}
+
+mem_arena_marker mem_arena_get_marker(const mem_arena_t* arena) {
+    mem_arena_marker marker;
+    marker.block = arena->current;
+    marker.used = arena->current->used;
+
+    return marker;
+}
+
+void mem_arena_rewind(mem_arena_t* arena, mem_arena_marker marker) {
+    arena->current = marker.block;
+    arena->current->used = marker.used;
+}
+
+void mem_arena_reset(mem_arena_t* arena) {
+    if (arena->first->next) {
+        size_t total_size = 0;
+        for (struct mem_arena_block* block = arena->first; block; block = block->next) {
+            total_size += block->size;
+        }
+
+        mem_arena_free_blocks(arena->first);
+        arena->first = mem_arena_block_create(total_size);
+    }
+
+    arena->first->used = 0;
+    arena->current = arena->first;
 }
@@ -1,11 +1,69 @@
 #ifndef MEM_H_
 #define MEM_H_
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
+// subsystems that allocations are accounted to
+typedef enum {
+    MEM_TAG_GENERAL = 0,
+    MEM_TAG_RASTERIZER,
+    MEM_TAG_CAPTURE,
+    MEM_TAG_IMGUI,
+    MEM_TAG_SDL,
+
+    MEM_TAG_COUNT
+} mem_tag;
+
+struct mem_tag_stats {
+    size_t live_bytes, peak_bytes;
+    uint64_t allocations, frees;
+
+    // during the last completed frame
+    uint64_t frame_allocations;
+    size_t frame_bytes;
+};
+
+// allocations without an explicit tag go to the tag of the calling thread
 void* mem_alloc(size_t size);
 void* mem_calloc(size_t nmemb, size_t size);
 void* mem_realloc(void* mem, size_t size);
 void mem_free(void* block);
 
+void* mem_alloc_tagged(size_t size, mem_tag tag);
+void* mem_calloc_tagged(size_t nmemb, size_t size, mem_tag tag);
+void* mem_realloc_tagged(void* mem, size_t size, mem_tag tag);
+
+// returns the previous tag of the calling thread, to restore later
+mem_tag mem_set_thread_tag(mem_tag tag);
+
+// accounting only happens if built with MEM_TRACKING. otherwise, this returns false
+bool mem_get_tag_stats(mem_tag tag, struct mem_tag_stats* stats);
+const char* mem_tag_name(mem_tag tag);
+
+// moves per-frame counters over to the stats of the last frame
+void mem_end_frame();
+
+// linear allocator for transient data. allocations are never freed individually, instead the
+// arena is rewound to a marker or reset as a whole. not thread safe
+typedef struct mem_arena mem_arena_t;
+
+typedef struct {
+    void* block;
+    size_t used;
+} mem_arena_marker;
+
+mem_arena_t* mem_arena_create(size_t block_size);
+void mem_arena_destroy(mem_arena_t* arena);
+
+void* mem_arena_alloc(mem_arena_t* arena, size_t size);
+
+mem_arena_marker mem_arena_get_marker(const mem_arena_t* arena);
+void mem_arena_rewind(mem_arena_t* arena, mem_arena_marker marker);
+
+// frees everything at once. if the arena had to grow, its blocks are merged into one big enough
+// for all of it, so that it stops growing after the first few frames
+void mem_arena_reset(mem_arena_t* arena);
+
 #endif
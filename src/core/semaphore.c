@@ -1,21 +1,23 @@
 #include "semaphore.h"
 
+#include "core/futex.h"
 #include "core/mem.h"
 
-#include <pthread.h>
+#include <limits.h>
 
-struct semaphore {
-    uint64_t value;
-    pthread_mutex_t mutex;
-    pthread_cond_t signal;
-};
+// checks this many times before sleeping
+#define WAIT_SPIN_COUNT 1024
+
+// set in the value while anyone sleeps on it, so that signals know to wake them up
+#define SEMAPHORE_PARKED (1u << 31)
+
+static atomic_uint_fast64_t s_immediate_waits;
+static atomic_uint_fast64_t s_spun_waits;
+static atomic_uint_fast64_t s_parked_waits;
 
 semaphore_t* semaphore_create() {
     semaphore_t* semaphore = mem_alloc(sizeof(semaphore_t));
-    semaphore->value = 0;
-
-    pthread_mutex_init(&semaphore->mutex, NULL);
-    pthread_cond_init(&semaphore->signal, NULL);
+    semaphore_init(semaphore, 0);
 
     return semaphore;
 }
@@ -25,27 +27,84 @@ void semaphore_destroy(semaphore_t* semaphore) {
         return;
     }
 
-    pthread_mutex_destroy(&semaphore->mutex);
-    pthread_cond_destroy(&semaphore->signal);
-
     mem_free(semaphore);
 }
 
-void semaphore_signal(semaphore_t *semaphore) {
-    pthread_mutex_lock(&semaphore->mutex);
-    semaphore->value++;
-    pthread_mutex_unlock(&semaphore->mutex);
+void semaphore_init(semaphore_t* semaphore, uint32_t value) {
+    atomic_init(&semaphore->value, value);
+    atomic_init(&semaphore->waiters, 0);
+}
+
+void semaphore_signal(semaphore_t* semaphore) {
+    // after this, the semaphore may be gone. waking only needs the address, and futex waits have
+    // to expect spurious wakeups anyway
+    atomic_uint* value = &semaphore->value;
+    uint32_t previous = atomic_fetch_add_explicit(value, 1, memory_order_seq_cst);
 
-    pthread_cond_signal(&semaphore->signal);
+    if ((previous & SEMAPHORE_PARKED) != 0) {
+        futex_wake(value, INT_MAX);
+    }
 }
 
-void semaphore_wait_for_value(semaphore_t *semaphore, uint64_t target) {
-    pthread_mutex_lock(&semaphore->mutex);
+bool semaphore_try_wait_for_value(semaphore_t* semaphore, uint32_t target) {
+    uint32_t value = atomic_load_explicit(&semaphore->value, memory_order_acquire);
+
+    while ((value & ~SEMAPHORE_PARKED) >= target) {
+        // anyone still asleep has to hear about later signals, so only the last waiter clears
+        // the flag
+        uint32_t parked = 0;
+        if (atomic_load_explicit(&semaphore->waiters, memory_order_seq_cst) > 0) {
+            parked = value & SEMAPHORE_PARKED;
+        }
 
-    while (semaphore->value < target) {
-        pthread_cond_wait(&semaphore->signal, &semaphore->mutex);
+        uint32_t remaining = (value & ~SEMAPHORE_PARKED) - target;
+        if (atomic_compare_exchange_weak_explicit(&semaphore->value, &value, remaining | parked,
+                                                  memory_order_seq_cst, memory_order_acquire)) {
+            return true;
+        }
     }
 
-    semaphore->value -= target;
-    pthread_mutex_unlock(&semaphore->mutex);
+    return false;
+}
+
+void semaphore_wait_for_value(semaphore_t* semaphore, uint32_t target) {
+    if (semaphore_try_wait_for_value(semaphore, target)) {
+        atomic_fetch_add_explicit(&s_immediate_waits, 1, memory_order_relaxed);
+        return;
+    }
+
+    for (uint32_t i = 0; i < WAIT_SPIN_COUNT; i++) {
+        cpu_relax();
+
+        if (semaphore_try_wait_for_value(semaphore, target)) {
+            atomic_fetch_add_explicit(&s_spun_waits, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    atomic_fetch_add_explicit(&s_parked_waits, 1, memory_order_relaxed);
+    while (!semaphore_try_wait_for_value(semaphore, target)) {
+        // pairs with the check in semaphore_try_wait_for_value. either it sees us and keeps the
+        // flag, or its exchange comes first and we see the new value
+        atomic_fetch_add_explicit(&semaphore->waiters, 1, memory_order_seq_cst);
+
+        uint32_t value = atomic_load_explicit(&semaphore->value, memory_order_seq_cst);
+        if ((value & ~SEMAPHORE_PARKED) < target) {
+            if ((value & SEMAPHORE_PARKED) != 0 ||
+                atomic_compare_exchange_strong_explicit(&semaphore->value, &value,
+                                                        value | SEMAPHORE_PARKED,
+                                                        memory_order_seq_cst,
+                                                        memory_order_seq_cst)) {
+                futex_wait(&semaphore->value, value | SEMAPHORE_PARKED);
+            }
+        }
+
+        atomic_fetch_sub_explicit(&semaphore->waiters, 1, memory_order_seq_cst);
+    }
+}
+
+void semaphore_get_stats(struct semaphore_stats* stats) {
+    stats->immediate = atomic_load_explicit(&s_immediate_waits, memory_order_relaxed);
+    stats->spun = atomic_load_explicit(&s_spun_waits, memory_order_relaxed);
+    stats->parked = atomic_load_explicit(&s_parked_waits, memory_order_relaxed);
 }
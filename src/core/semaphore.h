@@ -1,16 +1,49 @@
 #ifndef SEMAPHORE_H_
 #define SEMAPHORE_H_
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 
+// counting semaphore on a futex. waits spin for a short while before going to sleep. signaling
+// only touches the value and then wakes by address, so a waiter may get rid of the semaphore as
+// soon as it has what it needs, even if the signal that got it there hasn't returned yet
 typedef struct semaphore semaphore_t;
 
+struct semaphore {
+    // the value, plus a flag while anyone sleeps on it. futex word
+    atomic_uint value;
+
+    // threads that may be asleep on value. only touched by waiters
+    atomic_uint waiters;
+};
+
+// how waits have been satisfied so far, across every semaphore
+struct semaphore_stats {
+    // the value was already there
+    uint64_t immediate;
+
+    // the value showed up while spinning
+    uint64_t spun;
+
+    // had to sleep at least once
+    uint64_t parked;
+};
+
 semaphore_t* semaphore_create();
 void semaphore_destroy(semaphore_t* semaphore);
 
+// for semaphores that live somewhere else, e.g. on the stack. nothing to clean up afterwards
+void semaphore_init(semaphore_t* semaphore, uint32_t value);
+
 void semaphore_signal(semaphore_t* semaphore);
-void semaphore_wait_for_value(semaphore_t* semaphore, uint64_t target);
+
+// takes target from the value if it is at least that much, without waiting
+bool semaphore_try_wait_for_value(semaphore_t* semaphore, uint32_t target);
+void semaphore_wait_for_value(semaphore_t* semaphore, uint32_t target);
 
 #define semaphore_wait(semaphore) semaphore_wait_for_value(semaphore, 1)
 
+void semaphore_get_stats(struct semaphore_stats* stats);
+
 #endif
@@ -1,90 +1,488 @@
+// for cpu affinity
+#define _GNU_SOURCE
+
 #include "thread_worker.h"
 
 #include "core/mem.h"
-#include "core/list.h"
+#include "core/futex.h"
+#include "core/semaphore.h"
 
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 
+// jobs a thread can have queued locally. must be a power of 2
+#define DEQUE_CAPACITY 4096
+
+// jobs that threads outside of the worker can have queued. must be a power of 2
+#define INJECTION_CAPACITY 65536
+
+// how many times an idle thread looks for work before parking
+#define IDLE_SPIN_COUNT 64
+
+// padding between fields that different threads hammer on
+#define CACHE_LINE_SIZE 64
+
+// chase-lev deque. the owning thread pushes and pops at the bottom, everyone else steals from
+// the top
+struct job_deque {
+    atomic_llong top;
+    uint8_t top_padding[CACHE_LINE_SIZE - sizeof(atomic_llong)];
+
+    atomic_llong bottom;
+    uint8_t bottom_padding[CACHE_LINE_SIZE - sizeof(atomic_llong)];
+
+    _Atomic(void*) jobs[DEQUE_CAPACITY];
+};
+
+struct injection_slot {
+    atomic_size_t sequence;
+    void* job;
+};
+
+// bounded multi-producer multi-consumer queue, for jobs pushed from outside of the worker
+struct injection_queue {
+    atomic_size_t head;
+    uint8_t head_padding[CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+
+    atomic_size_t tail;
+    uint8_t tail_padding[CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+
+    struct injection_slot* slots;
+};
+
 struct worker_thread {
     pthread_t id;
     thread_worker_t* worker;
-};
 
-typedef struct thread_worker {
-    pthread_mutex_t mutex;
+    struct job_deque deque;
 
-    pthread_cond_t new_job;
-    struct list jobs;
+    // for picking steal victims
+    uint32_t random_state;
+};
 
+typedef struct thread_worker {
     uint32_t thread_count;
     struct worker_thread* threads;
 
-    pthread_cond_t thread_stopped;
-    bool should_stop;
-    uint32_t stopped_threads;
+    struct injection_queue injection;
+
+    // bumped whenever there might be new work. idle threads park on it
+    atomic_uint wake_epoch;
+    atomic_uint sleeping_threads;
+    atomic_bool should_stop;
 
     thread_worker_func callback;
     void* user_data;
 } thread_worker_t;
 
-static void* worker_thread_routine(void* user_data) {
-    struct worker_thread* thread = user_data;
+// parallel_for tickets are marked with this bit, to tell them apart from user jobs
+#define PARALLEL_FOR_TAG ((uintptr_t)1)
+
+struct parallel_for {
+    thread_worker_range_func func;
+    void* user_data;
+
+    uint32_t count, grain, chunk_count;
+    atomic_uint next_chunk;
+
+    // signaled by every ticket once it is done
+    semaphore_t retired;
+};
+
+struct shared_worker {
+    pthread_mutex_t mutex;
+
+    thread_worker_t* worker;
+    uint32_t references;
+
+    bool has_options;
+    struct thread_worker_options options;
+
+    // options->cpus is copied, the caller doesn't have to keep it around
+    uint32_t* cpus;
+};
+
+static struct shared_worker s_shared = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// set on threads started by a worker
+static _Thread_local struct worker_thread* current_thread = NULL;
+
+static bool deque_push(struct job_deque* deque, void* job) {
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+    if (bottom - top >= DEQUE_CAPACITY) {
+        return false;
+    }
+
+    atomic_store_explicit(&deque->jobs[bottom & (DEQUE_CAPACITY - 1)], job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+    return true;
+}
+
+static void* deque_pop(struct job_deque* deque) {
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    long long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        // empty
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    void* job = atomic_load_explicit(&deque->jobs[bottom & (DEQUE_CAPACITY - 1)],
+                                     memory_order_relaxed);
+
+    if (top == bottom) {
+        // last job, race against thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed)) {
+            job = NULL;
+        }
+
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return job;
+}
 
+static void* deque_steal(struct job_deque* deque) {
+    long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    void* job =
+        atomic_load_explicit(&deque->jobs[top & (DEQUE_CAPACITY - 1)], memory_order_relaxed);
+
+    // someone else got there first
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        return NULL;
+    }
+
+    return job;
+}
+
+static void injection_init(struct injection_queue* queue) {
+    queue->slots = mem_alloc(sizeof(struct injection_slot) * INJECTION_CAPACITY);
+    for (size_t i = 0; i < INJECTION_CAPACITY; i++) {
+        atomic_init(&queue->slots[i].sequence, i);
+    }
+
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+static bool injection_push(struct injection_queue* queue, void* job) {
+    size_t position = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    struct injection_slot* slot;
     while (true) {
-        pthread_mutex_lock(&thread->worker->mutex);
+        slot = &queue->slots[position & (INJECTION_CAPACITY - 1)];
+
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
 
-        while (!thread->worker->jobs.head) {
-            if (thread->worker->should_stop) {
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &position, position + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
                 break;
             }
+        } else if (difference < 0) {
+            // full
+            return false;
+        } else {
+            position = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+
+    slot->job = job;
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+
+    return true;
+}
+
+static void* injection_pop(struct injection_queue* queue) {
+    size_t position = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    struct injection_slot* slot;
+    while (true) {
+        slot = &queue->slots[position & (INJECTION_CAPACITY - 1)];
+
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
 
-            pthread_cond_wait(&thread->worker->new_job, &thread->worker->mutex);
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &position, position + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // empty
+            return NULL;
+        } else {
+            position = atomic_load_explicit(&queue->head, memory_order_relaxed);
         }
+    }
+
+    void* job = slot->job;
+    atomic_store_explicit(&slot->sequence, position + INJECTION_CAPACITY, memory_order_release);
 
-        if (thread->worker->should_stop) {
-            thread->worker->stopped_threads++;
-            pthread_mutex_unlock(&thread->worker->mutex);
+    return job;
+}
 
-            pthread_cond_signal(&thread->worker->thread_stopped);
+static uint32_t worker_thread_random(struct worker_thread* thread) {
+    // xorshift32
+    uint32_t x = thread->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    thread->random_state = x;
+    return x;
+}
+
+// thread is NULL when called from outside of the worker
+static void* thread_worker_find_job(thread_worker_t* worker, struct worker_thread* thread) {
+    void* job;
+    if (thread) {
+        job = deque_pop(&thread->deque);
+        if (job) {
+            return job;
+        }
+    }
+
+    job = injection_pop(&worker->injection);
+    if (job) {
+        return job;
+    }
+
+    // start at a random victim so that thieves don't all pile onto the same thread
+    uint32_t start = thread ? worker_thread_random(thread) % worker->thread_count : 0;
+    for (uint32_t i = 0; i < worker->thread_count; i++) {
+        struct worker_thread* victim = &worker->threads[(start + i) % worker->thread_count];
+        if (victim == thread) {
+            continue;
+        }
+
+        job = deque_steal(&victim->deque);
+        if (job) {
+            return job;
+        }
+    }
+
+    return NULL;
+}
+
+static void parallel_for_run_chunks(struct parallel_for* pf) {
+    while (true) {
+        uint32_t chunk = atomic_fetch_add_explicit(&pf->next_chunk, 1, memory_order_relaxed);
+        if (chunk >= pf->chunk_count) {
             break;
         }
 
-        struct list_node* head = thread->worker->jobs.head;
-        void* job = head->data;
-        list_remove(&thread->worker->jobs, head);
+        uint32_t begin = chunk * pf->grain;
+        uint32_t end = begin + pf->grain < pf->count ? begin + pf->grain : pf->count;
 
-        pthread_mutex_unlock(&thread->worker->mutex);
-        thread->worker->callback(thread->worker->user_data, job);
+        pf->func(pf->user_data, begin, end);
+    }
+}
+
+static void thread_worker_run_job(thread_worker_t* worker, void* job) {
+    uintptr_t address = (uintptr_t)job;
+
+    if ((address & PARALLEL_FOR_TAG) != 0) {
+        struct parallel_for* pf = (struct parallel_for*)(address & ~PARALLEL_FOR_TAG);
+        parallel_for_run_chunks(pf);
+
+        // pf may be gone as soon as the caller sees this, which the semaphore is fine with
+        semaphore_signal(&pf->retired);
+    } else {
+        worker->callback(worker->user_data, job);
+    }
+}
+
+static bool thread_worker_enqueue(thread_worker_t* worker, void* job) {
+    if (current_thread && current_thread->worker == worker) {
+        // our own deque first, the injection queue is shared with everyone
+        return deque_push(&current_thread->deque, job) || injection_push(&worker->injection, job);
+    }
+
+    return injection_push(&worker->injection, job);
+}
+
+static void thread_worker_wake(thread_worker_t* worker, uint32_t count) {
+    // pairs with the fence in worker_thread_park, so that either we see the sleeper or it sees
+    // the new job
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&worker->sleeping_threads, memory_order_relaxed) == 0) {
+        return;
+    }
+
+    atomic_fetch_add_explicit(&worker->wake_epoch, 1, memory_order_release);
+    futex_wake(&worker->wake_epoch, count);
+}
+
+// returns a job if one showed up while getting ready to sleep
+static void* worker_thread_park(struct worker_thread* thread) {
+    thread_worker_t* worker = thread->worker;
+    uint32_t epoch = atomic_load_explicit(&worker->wake_epoch, memory_order_acquire);
+
+    atomic_fetch_add_explicit(&worker->sleeping_threads, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // last look, now that pushers can see that we're going to sleep
+    void* job = thread_worker_find_job(worker, thread);
+    if (!job && !atomic_load_explicit(&worker->should_stop, memory_order_acquire)) {
+        futex_wait(&worker->wake_epoch, epoch);
+    }
+
+    atomic_fetch_sub_explicit(&worker->sleeping_threads, 1, memory_order_relaxed);
+    return job;
+}
+
+static void* worker_thread_routine(void* user_data) {
+    struct worker_thread* thread = user_data;
+    thread_worker_t* worker = thread->worker;
+
+    current_thread = thread;
+
+    uint32_t idle_count = 0;
+    while (true) {
+        void* job = thread_worker_find_job(worker, thread);
+
+        if (!job) {
+            if (atomic_load_explicit(&worker->should_stop, memory_order_acquire)) {
+                break;
+            }
+
+            if (idle_count++ < IDLE_SPIN_COUNT) {
+                cpu_relax();
+                continue;
+            }
+
+            job = worker_thread_park(thread);
+            if (!job) {
+                continue;
+            }
+        }
+
+        idle_count = 0;
+        thread_worker_run_job(worker, job);
     }
 
     return NULL;
 }
 
-thread_worker_t* thread_worker_start(thread_worker_func callback, void* user_data) {
+static void thread_worker_init_attributes(const struct thread_worker_options* options,
+                                         uint32_t thread_index, pthread_attr_t* attributes) {
+    pthread_attr_init(attributes);
+
+#ifdef __linux__
+    if (!options || !options->pin_threads) {
+        return;
+    }
+
+    uint32_t cpu;
+    if (options->cpus && options->cpu_count > 0) {
+        cpu = options->cpus[thread_index % options->cpu_count];
+    } else {
+        cpu = thread_index % (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    // threads can't be started on cpus that are offline or that we aren't allowed to run on
+    cpu_set_t allowed;
+    if (cpu >= CPU_SETSIZE || sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0 ||
+        !CPU_ISSET(cpu, &allowed)) {
+        fprintf(stderr, "thread_worker: cpu %u is not available, not pinning thread %u\n", cpu,
+                thread_index);
+
+        return;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+
+    int result = pthread_attr_setaffinity_np(attributes, sizeof(cpu_set_t), &cpus);
+    if (result != 0) {
+        fprintf(stderr, "thread_worker: failed to pin thread %u to cpu %u: %s\n", thread_index,
+                cpu, strerror(result));
+    }
+#endif
+}
+
+thread_worker_t* thread_worker_start(const struct thread_worker_options* options,
+                                     thread_worker_func callback, void* user_data) {
     thread_worker_t* worker = mem_alloc(sizeof(thread_worker_t));
-    pthread_mutex_init(&worker->mutex, NULL);
 
     worker->callback = callback;
     worker->user_data = user_data;
 
-    pthread_cond_init(&worker->new_job, NULL);
-    list_init(&worker->jobs);
+    injection_init(&worker->injection);
+
+    atomic_init(&worker->wake_epoch, 0);
+    atomic_init(&worker->sleeping_threads, 0);
+    atomic_init(&worker->should_stop, false);
+
+    if (options && options->thread_count > 0) {
+        worker->thread_count = options->thread_count;
+    } else {
+        worker->thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    }
 
-    worker->thread_count = sysconf(_SC_NPROCESSORS_ONLN);
     worker->threads = mem_alloc(sizeof(struct worker_thread) * worker->thread_count);
 
-    pthread_cond_init(&worker->thread_stopped, NULL);
-    worker->should_stop = false;
-    worker->stopped_threads = 0;
+    for (uint32_t i = 0; i < worker->thread_count; i++) {
+        struct worker_thread* thread = &worker->threads[i];
+        thread->worker = worker;
 
+        atomic_init(&thread->deque.top, 0);
+        atomic_init(&thread->deque.bottom, 0);
+
+        // has to be nonzero
+        thread->random_state = i + 1;
+    }
+
+    // all deques have to exist before anyone goes looking for work
     for (uint32_t i = 0; i < worker->thread_count; i++) {
         struct worker_thread* thread = &worker->threads[i];
 
-        thread->worker = worker;
-        pthread_create(&thread->id, NULL, worker_thread_routine, thread);
+        pthread_attr_t attributes;
+        thread_worker_init_attributes(options, i, &attributes);
+
+        // the affinity is only applied here, so this is where pinning actually fails
+        int result = pthread_create(&thread->id, &attributes, worker_thread_routine, thread);
+        pthread_attr_destroy(&attributes);
+
+        if (result != 0) {
+            fprintf(stderr, "thread_worker: failed to start thread %u (%s), retrying unpinned\n", i,
+                    strerror(result));
+
+            pthread_create(&thread->id, NULL, worker_thread_routine, thread);
+        }
     }
 
     return worker;
@@ -95,37 +493,162 @@ void thread_worker_stop(thread_worker_t* worker) {
         return;
     }
 
-    pthread_mutex_lock(&worker->mutex);
-    worker->should_stop = true;
+    // threads finish whatever is still queued before leaving
+    atomic_store_explicit(&worker->should_stop, true, memory_order_release);
 
-    while (worker->stopped_threads < worker->thread_count) {
-        // we do this so that waiting threads arent left hanging
-        pthread_cond_signal(&worker->new_job);
+    atomic_fetch_add_explicit(&worker->wake_epoch, 1, memory_order_release);
+    futex_wake(&worker->wake_epoch, INT_MAX);
 
-        pthread_cond_wait(&worker->thread_stopped, &worker->mutex);
+    for (uint32_t i = 0; i < worker->thread_count; i++) {
+        pthread_join(worker->threads[i].id, NULL);
     }
 
-    pthread_mutex_unlock(&worker->mutex);
+    mem_free(worker->injection.slots);
+    mem_free(worker->threads);
+    mem_free(worker);
+}
+
+thread_worker_t* thread_worker_acquire_shared() {
+    pthread_mutex_lock(&s_shared.mutex);
 
-    pthread_mutex_destroy(&worker->mutex);
-    pthread_cond_destroy(&worker->new_job);
-    pthread_cond_destroy(&worker->thread_stopped);
+    if (s_shared.references++ == 0) {
+        const struct thread_worker_options* options = NULL;
+        if (s_shared.has_options) {
+            options = &s_shared.options;
+        }
 
-    // shouldnt do anything but just to be safe ig
-    list_free(&worker->jobs);
+        s_shared.worker = thread_worker_start(options, NULL, NULL);
+    }
 
-    mem_free(worker->threads);
-    mem_free(worker);
+    thread_worker_t* worker = s_shared.worker;
+    pthread_mutex_unlock(&s_shared.mutex);
+
+    return worker;
+}
+
+void thread_worker_release_shared() {
+    pthread_mutex_lock(&s_shared.mutex);
+
+    if (s_shared.references > 0 && --s_shared.references == 0) {
+        thread_worker_stop(s_shared.worker);
+        s_shared.worker = NULL;
+    }
+
+    pthread_mutex_unlock(&s_shared.mutex);
+}
+
+void thread_worker_set_shared_options(const struct thread_worker_options* options) {
+    pthread_mutex_lock(&s_shared.mutex);
+
+    if (!s_shared.worker) {
+        mem_free(s_shared.cpus);
+        s_shared.cpus = NULL;
+
+        s_shared.has_options = options != NULL;
+        if (options) {
+            s_shared.options = *options;
+
+            if (options->cpus && options->cpu_count > 0) {
+                size_t cpus_size = sizeof(uint32_t) * options->cpu_count;
+                s_shared.cpus = mem_alloc(cpus_size);
+                memcpy(s_shared.cpus, options->cpus, cpus_size);
+
+                s_shared.options.cpus = s_shared.cpus;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&s_shared.mutex);
 }
 
 uint32_t thread_worker_get_thread_count(const thread_worker_t* worker) {
     return worker->thread_count;
 }
 
+uint32_t thread_worker_get_thread_index(const thread_worker_t* worker) {
+    if (!current_thread || current_thread->worker != worker) {
+        return worker->thread_count;
+    }
+
+    return (uint32_t)(current_thread - worker->threads);
+}
+
 void thread_worker_push_job(thread_worker_t* worker, void* job) {
-    pthread_mutex_lock(&worker->mutex);
-    list_append(&worker->jobs, job);
-    pthread_mutex_unlock(&worker->mutex);
+    // everything is backed up, so it won't hurt to do it ourselves
+    if (!thread_worker_enqueue(worker, job)) {
+        worker->callback(worker->user_data, job);
+        return;
+    }
+
+    thread_worker_wake(worker, 1);
+}
+
+void thread_worker_parallel_for(thread_worker_t* worker, uint32_t count, uint32_t grain,
+                                thread_worker_range_func func, void* user_data) {
+    if (count == 0) {
+        return;
+    }
+
+    if (grain == 0) {
+        grain = 1;
+    }
 
-    pthread_cond_signal(&worker->new_job);
+    struct parallel_for pf;
+    pf.func = func;
+    pf.user_data = user_data;
+    pf.count = count;
+    pf.grain = grain;
+    pf.chunk_count = (count + grain - 1) / grain;
+
+    atomic_init(&pf.next_chunk, 0);
+    semaphore_init(&pf.retired, 0);
+
+    // we take chunks ourselves, so we only need help with the rest
+    uint32_t tickets = 0;
+    if (worker && pf.chunk_count > 1) {
+        tickets = pf.chunk_count - 1;
+        tickets = tickets < worker->thread_count ? tickets : worker->thread_count;
+    }
+
+    // every ticket is the same job. whoever runs it keeps taking chunks until there are none left
+    void* ticket = (void*)((uintptr_t)&pf | PARALLEL_FOR_TAG);
+    uint32_t queued = 0;
+    for (uint32_t i = 0; i < tickets; i++) {
+        // if there is nowhere to put it, we'll just take its chunks ourselves
+        if (thread_worker_enqueue(worker, ticket)) {
+            queued++;
+        }
+    }
+
+    if (queued > 0) {
+        thread_worker_wake(worker, queued);
+    }
+
+    parallel_for_run_chunks(&pf);
+
+    // tickets still reference pf, so we can't return before all of them are retired. worker
+    // threads help out with whatever else is queued in the meantime, which includes our own
+    // tickets. other threads only ever run chunks of their own parallel_for: they all report the
+    // same thread index, so a job from another caller could end up sharing per-thread data with
+    // the thread that is waiting on it
+    struct worker_thread* thread = current_thread && current_thread->worker == worker
+                                       ? current_thread
+                                       : NULL;
+
+    bool retired = semaphore_try_wait_for_value(&pf.retired, queued);
+    while (!retired && thread) {
+        void* job = thread_worker_find_job(worker, thread);
+        if (!job) {
+            break;
+        }
+
+        thread_worker_run_job(worker, job);
+        retired = semaphore_try_wait_for_value(&pf.retired, queued);
+    }
+
+    // the remaining tickets are running elsewhere, or waiting for a thread to pick them up.
+    // either way there is nothing left for us to do but wait for the last one
+    if (!retired) {
+        semaphore_wait_for_value(&pf.retired, queued);
+    }
 }
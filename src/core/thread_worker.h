@@ -1,17 +1,54 @@
 #ifndef MT_WORKER_H_
 #define MT_WORKER_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef struct thread_worker thread_worker_t;
 
+struct thread_worker_options {
+    // 0 starts one thread per online cpu
+    uint32_t thread_count;
+
+    // pins thread i to cpus[i % cpu_count], or to cpu i % online cpus if cpus is NULL. only
+    // supported on linux
+    bool pin_threads;
+    const uint32_t* cpus;
+    uint32_t cpu_count;
+};
+
 typedef void (*thread_worker_func)(void* user_data, void* job);
+typedef void (*thread_worker_range_func)(void* user_data, uint32_t begin, uint32_t end);
+
+// callback runs jobs pushed with thread_worker_push_job. may be NULL if only parallel_for is used.
+// options may be NULL for the defaults
+thread_worker_t* thread_worker_start(const struct thread_worker_options* options,
+                                     thread_worker_func callback, void* user_data);
 
-thread_worker_t* thread_worker_start(thread_worker_func callback, void* user_data);
 void thread_worker_stop(thread_worker_t* worker);
 
+// process-wide worker, started on the first acquire and stopped when the last reference is
+// released. it has no callback, so it only supports parallel_for
+thread_worker_t* thread_worker_acquire_shared();
+void thread_worker_release_shared();
+
+// options for the shared worker. only has an effect before it is started
+void thread_worker_set_shared_options(const struct thread_worker_options* options);
+
 uint32_t thread_worker_get_thread_count(const thread_worker_t* worker);
 
+// index of the calling thread within the worker, from 0 to the thread count. threads that don't
+// belong to the worker get the thread count itself
+uint32_t thread_worker_get_thread_index(const thread_worker_t* worker);
+
+// job must not be NULL. if every queue is full, the job runs on the calling thread instead
 void thread_worker_push_job(thread_worker_t* worker, void* job);
 
+// runs func over [0, count) in chunks of at most grain, and returns once all of them are done. the
+// calling thread works on chunks too, and worker may be NULL to do everything on the calling
+// thread. threads outside of the worker never run anything but their own chunks, and sleep if the
+// rest takes a while
+void thread_worker_parallel_for(thread_worker_t* worker, uint32_t count, uint32_t grain,
+                                thread_worker_range_func func, void* user_data);
+
 #endif
@@ -17,7 +17,7 @@ struct capture {
 };
 
 capture_t* capture_new() {
-    capture_t* cap = mem_alloc(sizeof(capture_t));
+    capture_t* cap = mem_alloc_tagged(sizeof(capture_t), MEM_TAG_CAPTURE);
     list_init(&cap->events);
 
     return cap;
@@ -96,6 +96,9 @@ static void capture_take_snapshot(struct capture_event* ev, const struct framebu
 
 static struct capture_event* capture_create_event(capture_t* cap, capture_event_type type,
                                                   const struct framebuffer* fb) {
+    // snapshots and list nodes are allocated elsewhere, but they belong to us
+    mem_tag previous_tag = mem_set_thread_tag(MEM_TAG_CAPTURE);
+
     struct capture_event* ev = mem_alloc(sizeof(struct capture_event));
     ev->type = type;
 
@@ -107,6 +110,8 @@ static struct capture_event* capture_create_event(capture_t* cap, capture_event_
     }
 
     list_append(&cap->events, ev);
+
+    mem_set_thread_tag(previous_tag);
     return ev;
 }
 
@@ -121,7 +126,7 @@ void capture_add_framebuffer_clear(capture_t* cap, const struct framebuffer* fb,
     struct capture_event* ev = capture_create_event(cap, CAPTURE_EVENT_TYPE_FRAMEBUFFER_CLEAR, fb);
     
     size_t buf_size = fb->attachment_count * sizeof(image_pixel);
-    ev->fb_clear.clear_values = mem_alloc(buf_size);
+    ev->fb_clear.clear_values = mem_alloc_tagged(buf_size, MEM_TAG_CAPTURE);
     memcpy(ev->fb_clear.clear_values, clear_values, buf_size);
 }
 
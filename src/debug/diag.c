@@ -2,6 +2,7 @@
 
 #include "core/list.h"
 #include "core/mem.h"
+#include "core/semaphore.h"
 #include "debug/capture.h"
 
 #define CIMGUI_DEFINE_ENUMS_AND_STRUCTS
@@ -125,6 +126,79 @@ static void diag_show_capture(struct capture_viewer* viewer, bool* show) {
     igEnd();
 }
 
+static void diag_format_bytes(char* buf, size_t buf_size, size_t bytes) {
+    static const char* const units[] = { "B", "KiB", "MiB", "GiB" };
+    static const uint32_t unit_count = sizeof(units) / sizeof(units[0]);
+
+    double value = (double)bytes;
+    uint32_t unit = 0;
+
+    while (value >= 1024.0 && unit < unit_count - 1) {
+        value /= 1024.0;
+        unit++;
+    }
+
+    snprintf(buf, buf_size, unit > 0 ? "%.1f %s" : "%.0f %s", value, units[unit]);
+}
+
+static void diag_show_memory() {
+    igBegin("Memory", NULL, ImGuiWindowFlags_None);
+
+    struct mem_tag_stats stats;
+    if (!mem_get_tag_stats(MEM_TAG_GENERAL, &stats)) {
+        igText("Memory tracking is disabled. Build with RAST_MEM_TRACKING to enable it.");
+        igEnd();
+
+        return;
+    }
+
+    static const char* const headers[] = {
+        "Tag", "Live", "Peak", "Allocations", "Frees", "Frame", "Frame bytes",
+    };
+
+    static const uint32_t column_count = sizeof(headers) / sizeof(headers[0]);
+    igColumns(column_count, NULL, true);
+
+    for (uint32_t i = 0; i < column_count; i++) {
+        igText("%s", headers[i]);
+        igNextColumn();
+    }
+
+    igSeparator();
+
+    char buf[64];
+    for (uint32_t i = 0; i < MEM_TAG_COUNT; i++) {
+        mem_get_tag_stats(i, &stats);
+
+        igText("%s", mem_tag_name(i));
+        igNextColumn();
+
+        diag_format_bytes(buf, sizeof(buf), stats.live_bytes);
+        igText("%s", buf);
+        igNextColumn();
+
+        diag_format_bytes(buf, sizeof(buf), stats.peak_bytes);
+        igText("%s", buf);
+        igNextColumn();
+
+        igText("%llu", (unsigned long long)stats.allocations);
+        igNextColumn();
+
+        igText("%llu", (unsigned long long)stats.frees);
+        igNextColumn();
+
+        igText("%llu", (unsigned long long)stats.frame_allocations);
+        igNextColumn();
+
+        diag_format_bytes(buf, sizeof(buf), stats.frame_bytes);
+        igText("%s", buf);
+        igNextColumn();
+    }
+
+    igColumns(1, NULL, false);
+    igEnd();
+}
+
 static void diag_append_viewer(capture_t* cap) {
     struct capture_viewer* viewer = mem_alloc(sizeof(struct capture_viewer));
     viewer->cap = s_diag->current_capture;
@@ -161,9 +235,19 @@ void diag_update() {
             s_diag->current_capture = capture_new();
         }
 
+        // mostly the joins of parallel_for
+        struct semaphore_stats waits;
+        semaphore_get_stats(&waits);
+
+        igText("Semaphore waits: %llu immediate, %llu spun, %llu parked",
+               (unsigned long long)waits.immediate, (unsigned long long)waits.spun,
+               (unsigned long long)waits.parked);
+
         igEnd();
     }
 
+    diag_show_memory();
+
     struct list_node* cur = s_diag->viewers.head;
     while (cur) {
         bool show = true;
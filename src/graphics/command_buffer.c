@@ -0,0 +1,141 @@
+#include "command_buffer.h"
+#include "rasterizer_internal.h"
+
+#include "core/mem.h"
+#include "math/geo.h"
+#include "graphics/image.h"
+
+#include <string.h>
+
+// most frames fit in the first block
+#define COMMAND_ARENA_BLOCK_SIZE (1 << 16)
+
+command_buffer_t* command_buffer_create() {
+    mem_tag previous_tag = mem_set_thread_tag(MEM_TAG_RASTERIZER);
+    command_buffer_t* cmd = mem_alloc(sizeof(command_buffer_t));
+
+    cmd->commands = NULL;
+    cmd->command_count = cmd->capacity = 0;
+
+    cmd->arena = mem_arena_create(COMMAND_ARENA_BLOCK_SIZE);
+
+    mem_set_thread_tag(previous_tag);
+    return cmd;
+}
+
+void command_buffer_destroy(command_buffer_t* cmd) {
+    if (!cmd) {
+        return;
+    }
+
+    mem_arena_destroy(cmd->arena);
+
+    mem_free(cmd->commands);
+    mem_free(cmd);
+}
+
+void command_buffer_reset(command_buffer_t* cmd) {
+    cmd->command_count = 0;
+
+    mem_tag previous_tag = mem_set_thread_tag(MEM_TAG_RASTERIZER);
+    mem_arena_reset(cmd->arena);
+    mem_set_thread_tag(previous_tag);
+}
+
+void* command_buffer_copy(command_buffer_t* cmd, const void* data, size_t size) {
+    mem_tag previous_tag = mem_set_thread_tag(MEM_TAG_RASTERIZER);
+    void* copy = mem_arena_alloc(cmd->arena, size);
+    mem_set_thread_tag(previous_tag);
+
+    memcpy(copy, data, size);
+    return copy;
+}
+
+static struct command* command_buffer_append(command_buffer_t* cmd, command_type type) {
+    if (cmd->command_count >= cmd->capacity) {
+        cmd->capacity = cmd->capacity > 0 ? cmd->capacity * 2 : 16;
+
+        size_t size = sizeof(struct command) * cmd->capacity;
+        cmd->commands = mem_realloc_tagged(cmd->commands, size, MEM_TAG_RASTERIZER);
+    }
+
+    struct command* command = &cmd->commands[cmd->command_count++];
+    command->type = type;
+
+    return command;
+}
+
+// framebuffers are usually rebuilt every frame, so we don't hold onto the caller's
+static struct framebuffer* command_buffer_copy_framebuffer(command_buffer_t* cmd,
+                                                           const struct framebuffer* fb) {
+    struct framebuffer* copy = command_buffer_copy(cmd, fb, sizeof(struct framebuffer));
+
+    size_t attachments_size = sizeof(image_t*) * fb->attachment_count;
+    copy->attachments = command_buffer_copy(cmd, fb->attachments, attachments_size);
+
+    return copy;
+}
+
+void command_buffer_clear(command_buffer_t* cmd, const struct framebuffer* fb,
+                          const image_pixel* clear_values) {
+    struct command* command = command_buffer_append(cmd, COMMAND_TYPE_CLEAR);
+    command->clear.fb = command_buffer_copy_framebuffer(cmd, fb);
+
+    size_t values_size = sizeof(image_pixel) * fb->attachment_count;
+    command->clear.clear_values = command_buffer_copy(cmd, clear_values, values_size);
+}
+
+// fb is the copy of the call's framebuffer
+static void command_buffer_copy_render_call(command_buffer_t* cmd,
+                                            const struct indexed_render_call* data,
+                                            struct framebuffer* fb,
+                                            struct indexed_render_call* call) {
+    memcpy(call, data, sizeof(struct indexed_render_call));
+
+    size_t vertices_size = sizeof(struct vertex_buffer) * data->pipeline->binding_count;
+    call->vertices = command_buffer_copy(cmd, data->vertices, vertices_size);
+
+    call->framebuffer = fb;
+
+    if (data->scissor_rect) {
+        call->scissor_rect = command_buffer_copy(cmd, data->scissor_rect, sizeof(struct rect));
+    }
+}
+
+void command_buffer_render_indexed(command_buffer_t* cmd, const struct indexed_render_call* data) {
+    struct command* command = command_buffer_append(cmd, COMMAND_TYPE_RENDER_INDEXED);
+
+    struct framebuffer* fb = command_buffer_copy_framebuffer(cmd, data->framebuffer);
+    command_buffer_copy_render_call(cmd, data, fb, &command->render_indexed);
+}
+
+void command_buffer_render_indexed_batch(command_buffer_t* cmd,
+                                         const struct indexed_render_call* calls,
+                                         uint32_t call_count) {
+    struct command* command = command_buffer_append(cmd, COMMAND_TYPE_RENDER_INDEXED_BATCH);
+
+    mem_tag previous_tag = mem_set_thread_tag(MEM_TAG_RASTERIZER);
+    size_t calls_size = sizeof(struct indexed_render_call) * call_count;
+    struct indexed_render_call* copies = mem_arena_alloc(cmd->arena, calls_size);
+    mem_set_thread_tag(previous_tag);
+
+    struct framebuffer* fb = NULL;
+    for (uint32_t i = 0; i < call_count; i++) {
+        // batches tend to render everything to one framebuffer, which only needs one copy
+        if (i == 0 || calls[i].framebuffer != calls[i - 1].framebuffer) {
+            fb = command_buffer_copy_framebuffer(cmd, calls[i].framebuffer);
+        }
+
+        command_buffer_copy_render_call(cmd, &calls[i], fb, &copies[i]);
+    }
+
+    command->render_indexed_batch.calls = copies;
+    command->render_indexed_batch.call_count = call_count;
+}
+
+void command_buffer_render_arrays(command_buffer_t* cmd, const struct array_render_call* data) {
+    struct indexed_render_call call;
+    array_render_call_to_indexed(data, &call);
+
+    command_buffer_render_indexed(cmd, &call);
+}
@@ -0,0 +1,39 @@
+#ifndef COMMAND_BUFFER_H_
+#define COMMAND_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// from rasterizer.h
+struct framebuffer;
+struct indexed_render_call;
+struct array_render_call;
+typedef union image_pixel image_pixel;
+
+// records clears and render calls, to be run later with rasterizer_submit. calls are copied, but
+// anything they point to other than vertex buffer descriptions, framebuffers and scissor rects is
+// referenced, and has to stay alive and unchanged until execution is done. command_buffer_copy
+// gives transient data the same lifetime as the commands themselves
+typedef struct command_buffer command_buffer_t;
+
+command_buffer_t* command_buffer_create();
+void command_buffer_destroy(command_buffer_t* cmd);
+
+// forgets every command and copy. the command buffer must not be executing
+void command_buffer_reset(command_buffer_t* cmd);
+
+// valid until the command buffer is reset
+void* command_buffer_copy(command_buffer_t* cmd, const void* data, size_t size);
+
+void command_buffer_clear(command_buffer_t* cmd, const struct framebuffer* fb,
+                          const image_pixel* clear_values);
+
+void command_buffer_render_indexed(command_buffer_t* cmd, const struct indexed_render_call* data);
+
+// see render_indexed_batch
+void command_buffer_render_indexed_batch(command_buffer_t* cmd,
+                                         const struct indexed_render_call* calls,
+                                         uint32_t call_count);
+void command_buffer_render_arrays(command_buffer_t* cmd, const struct array_render_call* data);
+
+#endif
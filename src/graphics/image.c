@@ -23,6 +23,9 @@ image_t* image_allocate(uint32_t width, uint32_t height, image_format format) {
     image->height = height;
     image->format = format;
     image->pixel_stride = pixel_stride;
+    image->depth_hierarchy = NULL;
+    image->mips = NULL;
+    image->mip_count = 0;
 
     return image;
 }
@@ -32,6 +35,15 @@ void image_free(image_t* image) {
         return;
     }
 
+    // a single allocation
+    mem_free(image->depth_hierarchy);
+
+    for (uint32_t i = 0; i < image->mip_count; i++) {
+        image_free(image->mips[i]);
+    }
+
+    mem_free(image->mips);
+
     mem_free(image->data);
     mem_free(image);
 }
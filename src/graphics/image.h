@@ -14,12 +14,24 @@ typedef enum {
     IMAGE_FORMAT_DEPTH,
 } image_format;
 
+// from rasterizer.c
+struct depth_hierarchy;
+
 typedef struct image {
     void* data;
 
     uint32_t width, height;
     image_format format;
     size_t pixel_stride;
+
+    // depth images only, maintained by the rasterizer. free it and set it to NULL after writing to
+    // data by other means, and it will be rebuilt
+    struct depth_hierarchy* depth_hierarchy;
+
+    // color images only, built by texture_generate_mips. each level is half the size of the one
+    // before it, starting from the image itself. stale once data is written to
+    struct image** mips;
+    uint32_t mip_count;
 } image_t;
 
 image_t* image_allocate(uint32_t width, uint32_t height, image_format format);
@@ -2,17 +2,15 @@
 
 #include "core/mem.h"
 #include "core/util.h"
+#include "graphics/command_buffer.h"
 #include "graphics/rasterizer.h"
 #include "graphics/image.h"
 #include "graphics/texture.h"
-#include "math/mat.h"
 #include "math/geo.h"
 
 #include <string.h>
 
 struct imgui_renderer_data {
-    rasterizer_t* rast;
-
     struct pipeline pipeline;
     struct vertex_binding binding;
     struct blended_parameter blended_params[2];
@@ -26,8 +24,11 @@ struct imgui_fragment_data {
     float color[4];
 };
 
+// display coordinates to ndc: ndc = position * scale + offset
 struct imgui_uniform_data {
-    float projection[4 * 4];
+    float scale[2];
+    float offset[2];
+
     struct texture tex;
 };
 
@@ -43,13 +44,9 @@ static void imgui_vertex_shader(const void* const* bindings, const struct shader
     const struct ImDrawVert* vertex = bindings[0];
     const struct imgui_uniform_data* render_data = context->uniform_data;
 
-    float input_pos[4];
-    input_pos[0] = vertex->pos.x;
-    input_pos[1] = vertex->pos.y;
-    input_pos[2] = 0.f;
-    input_pos[3] = 1.f;
-
-    mat_dot(render_data->projection, input_pos, 4, 4, 1, position);
+    // w stays at 1, so nothing needs perspective correction
+    position[0] = vertex->pos.x * render_data->scale[0] + render_data->offset[0];
+    position[1] = vertex->pos.y * render_data->scale[1] + render_data->offset[1];
 
     struct imgui_fragment_data* frag_data = context->working_data;
     memcpy(frag_data->uv, &vertex->uv, 2 * sizeof(float));
@@ -71,14 +68,16 @@ static uint32_t imgui_fragment_shader(const struct shader_context* context) {
     return util_float4_to_u32(color);
 }
 
-static void* imgui_mem_alloc(size_t size, void* user_data) { return mem_alloc(size); }
+static void* imgui_mem_alloc(size_t size, void* user_data) {
+    return mem_alloc_tagged(size, MEM_TAG_IMGUI);
+}
+
 static void imgui_mem_free(void* block, void* user_data) { return mem_free(block); }
 
 void imgui_set_allocators() { igSetAllocatorFunctions(imgui_mem_alloc, imgui_mem_free, NULL); }
 
-void imgui_init_renderer(rasterizer_t* rast) {
+void imgui_init_renderer() {
     struct imgui_renderer_data* data = mem_alloc(sizeof(struct imgui_renderer_data));
-    data->rast = rast;
 
     ImGuiIO* io = igGetIO_Nil();
     io->BackendRendererName = "rast";
@@ -94,6 +93,7 @@ void imgui_init_renderer(rasterizer_t* rast) {
     data->pipeline.shader.fragment_stage = imgui_fragment_shader;
     data->pipeline.shader.inter_stage_parameter_count = 2;
     data->pipeline.shader.inter_stage_parameters = data->blended_params;
+    data->pipeline.shader.linear_interpolation = true;
     data->pipeline.binding_count = 1;
     data->pipeline.bindings = &data->binding;
     data->pipeline.topology = TOPOLOGY_TYPE_TRIANGLES;
@@ -121,6 +121,8 @@ void imgui_init_renderer(rasterizer_t* rast) {
     data->color_blending.alpha.src_factor = BLEND_FACTOR_ONE;
     data->color_blending.alpha.dst_factor = BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
 
+    // the font atlas is drawn at 1:1, it doesn't need mips
+    memset(&data->sampler, 0, sizeof(struct sampler));
     data->sampler.filter = SAMPLER_FILTER_NEAREST;
     data->sampler.wrapping = SAMPLER_WRAPPING_REPEAT;
 
@@ -210,45 +212,27 @@ static void imgui_update_texture(ImTextureData* tex) {
     }
 }
 
-void imgui_render(ImDrawData* data, struct framebuffer* fb) {
+void imgui_render(ImDrawData* data, struct framebuffer* fb, command_buffer_t* cmd) {
     ImGuiIO* io = igGetIO_Nil();
     struct imgui_renderer_data* renderer_data = io->BackendRendererUserData;
 
-    float scale[2];
-    scale[0] = 2.f / data->DisplaySize.x;
-    scale[1] = 2.f / data->DisplaySize.y;
-
     struct imgui_uniform_data uniforms;
-    mat_identity(uniforms.projection, 4);
-
-    // projection[0, 0]
-    uniforms.projection[0] = scale[0];
-
-    // projection[1, 1]
-    uniforms.projection[5] = scale[1];
-
-    // projection[0, 3]
-    uniforms.projection[3] = -1.f - data->DisplayPos.x * scale[0];
-
-    // projection[1, 3]
-    uniforms.projection[7] = -1.f - data->DisplayPos.y * scale[1];
-
-    // projection[2, 3]
-    // bug: rasterizer doesn't like it when we use z=0 for vertices
-    uniforms.projection[11] = 0.1f;
+    uniforms.scale[0] = 2.f / data->DisplaySize.x;
+    uniforms.scale[1] = 2.f / data->DisplaySize.y;
+    uniforms.offset[0] = -1.f - data->DisplayPos.x * uniforms.scale[0];
+    uniforms.offset[1] = -1.f - data->DisplayPos.y * uniforms.scale[1];
 
     uniforms.tex.sampler = &renderer_data->sampler;
 
     struct indexed_render_call call;
-    struct rect scissor;
-
     memset(&call, 0, sizeof(struct indexed_render_call));
     call.pipeline = &renderer_data->pipeline;
     call.framebuffer = fb;
     call.first_instance = 0;
     call.instance_count = 1;
-    call.uniform_data = &uniforms;
-    call.scissor_rect = &scissor;
+
+    // imgui can be built with 32 bit indices
+    call.index_type = sizeof(ImDrawIdx) == sizeof(uint32_t) ? INDEX_TYPE_U32 : INDEX_TYPE_U16;
 
     ImVec2 scissor_offset = data->DisplayPos;
     ImVec2 scissor_scale = data->FramebufferScale;
@@ -262,43 +246,72 @@ void imgui_render(ImDrawData* data, struct framebuffer* fb) {
         }
     }
 
+    // a frame is hundreds of tiny draws, which all go out as one batch
+    uint32_t max_calls = 0;
+    for (int i = 0; i < data->CmdListsCount; i++) {
+        max_calls += (uint32_t)data->CmdLists.Data[i]->CmdBuffer.Size;
+    }
+
+    if (max_calls == 0) {
+        return;
+    }
+
+    struct indexed_render_call* calls =
+        mem_alloc_tagged(sizeof(struct indexed_render_call) * max_calls, MEM_TAG_IMGUI);
+
+    struct rect* scissors = mem_alloc_tagged(sizeof(struct rect) * max_calls, MEM_TAG_IMGUI);
+    uint32_t call_count = 0;
+
     for (int i = 0; i < data->CmdListsCount; i++) {
         ImDrawList* draw_list = data->CmdLists.Data[i];
 
+        // draw lists are rebuilt next frame, possibly while this one is still rendering
         struct vertex_buffer vbuf;
-        vbuf.data = draw_list->VtxBuffer.Data;
         vbuf.size = draw_list->VtxBuffer.Size * sizeof(struct ImDrawVert);
+        vbuf.data = command_buffer_copy(cmd, draw_list->VtxBuffer.Data, vbuf.size);
 
-        call.vertices = &vbuf;
-        call.indices = draw_list->IdxBuffer.Data;
+        size_t indices_size = draw_list->IdxBuffer.Size * sizeof(ImDrawIdx);
+        call.vertices = command_buffer_copy(cmd, &vbuf, sizeof(struct vertex_buffer));
+        call.indices = command_buffer_copy(cmd, draw_list->IdxBuffer.Data, indices_size);
 
         for (int j = 0; j < draw_list->CmdBuffer.Size; j++) {
-            ImDrawCmd* cmd = &draw_list->CmdBuffer.Data[j];
+            ImDrawCmd* draw_cmd = &draw_list->CmdBuffer.Data[j];
 
-            if (cmd->UserCallback) {
-                cmd->UserCallback(draw_list, cmd);
+            if (draw_cmd->UserCallback) {
+                draw_cmd->UserCallback(draw_list, draw_cmd);
                 continue;
             }
 
-            call.vertex_offset = cmd->VtxOffset;
-            call.first_index = cmd->IdxOffset;
-            call.index_count = cmd->ElemCount;
+            call.vertex_offset = draw_cmd->VtxOffset;
+            call.first_index = draw_cmd->IdxOffset;
+            call.index_count = draw_cmd->ElemCount;
 
-            ImTextureID tex_id = ImDrawCmd_GetTexID(cmd);
+            ImTextureID tex_id = ImDrawCmd_GetTexID(draw_cmd);
             uniforms.tex.image = (image_t*)tex_id;
 
             float scissor_min[2], scissor_max[2];
-            scissor_min[0] = (cmd->ClipRect.x - scissor_offset.x) * scissor_scale.x;
-            scissor_min[1] = (cmd->ClipRect.y - scissor_offset.y) * scissor_scale.y;
-            scissor_max[0] = (cmd->ClipRect.z - scissor_offset.x) * scissor_scale.x;
-            scissor_max[1] = (cmd->ClipRect.w - scissor_offset.y) * scissor_scale.y;
-
-            scissor.x = (int32_t)scissor_min[0];
-            scissor.y = (int32_t)scissor_min[1];
-            scissor.width = (uint32_t)(scissor_max[0] - scissor_min[0]);
-            scissor.height = (uint32_t)(scissor_max[1] - scissor_min[1]);
-
-            render_indexed(renderer_data->rast, &call);
+            scissor_min[0] = (draw_cmd->ClipRect.x - scissor_offset.x) * scissor_scale.x;
+            scissor_min[1] = (draw_cmd->ClipRect.y - scissor_offset.y) * scissor_scale.y;
+            scissor_max[0] = (draw_cmd->ClipRect.z - scissor_offset.x) * scissor_scale.x;
+            scissor_max[1] = (draw_cmd->ClipRect.w - scissor_offset.y) * scissor_scale.y;
+
+            struct rect* scissor = &scissors[call_count];
+            scissor->x = (int32_t)scissor_min[0];
+            scissor->y = (int32_t)scissor_min[1];
+            scissor->width = (uint32_t)(scissor_max[0] - scissor_min[0]);
+            scissor->height = (uint32_t)(scissor_max[1] - scissor_min[1]);
+            call.scissor_rect = scissor;
+
+            // every call gets its own copy, since the texture changes between them
+            size_t uniforms_size = sizeof(struct imgui_uniform_data);
+            call.uniform_data = command_buffer_copy(cmd, &uniforms, uniforms_size);
+
+            calls[call_count++] = call;
         }
     }
+
+    command_buffer_render_indexed_batch(cmd, calls, call_count);
+
+    mem_free(scissors);
+    mem_free(calls);
 }
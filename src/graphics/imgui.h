@@ -9,14 +9,16 @@
 // from rasterizer.h
 struct framebuffer;
 
-// from rasterizer.h
-typedef struct rasterizer rasterizer_t;
+// from command_buffer.h
+typedef struct command_buffer command_buffer_t;
 
 void imgui_set_allocators();
 
-void imgui_init_renderer(rasterizer_t* rast);
+void imgui_init_renderer();
 void imgui_shutdown_renderer();
 
-void imgui_render(ImDrawData* data, struct framebuffer* fb);
+// records draw data into cmd, copying everything that imgui rebuilds every frame. textures are
+// updated immediately, so nothing sampling them may be executing
+void imgui_render(ImDrawData* data, struct framebuffer* fb, command_buffer_t* cmd);
 
 #endif
@@ -0,0 +1,175 @@
+#include "rasterizer_internal.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RASTER_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// depth at the first pixel of the row
+static float row_start_depth(const struct raster_row* row) {
+    const struct primitive* prim = row->prim;
+    const struct attribute_plane* plane = &prim->depth;
+
+    float offset_x = (float)((int32_t)row->x - prim->origin_x);
+    float offset_y = (float)((int32_t)row->y - prim->origin_y);
+
+    return plane->origin + plane->dy * offset_y + plane->dx * offset_x;
+}
+
+static uint32_t raster_row_scalar(const struct raster_row* row, struct raster_row_result* result) {
+    const struct primitive* prim = row->prim;
+    float row_depth = row_start_depth(row);
+
+    int64_t values[MAX_PRIMITIVE_VERTICES];
+    memcpy(values, row->values, row->vertices * sizeof(int64_t));
+
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < row->width; i++) {
+        bool covered = true;
+
+        for (uint8_t j = 0; j < row->vertices; j++) {
+            if ((row->coverage_edges & (1 << j)) != 0 && values[j] <= 0) {
+                covered = false;
+            }
+
+            values[j] += prim->edges[j].a;
+        }
+
+        // same arithmetic as the simd kernels, so that they all produce the same depths
+        float depth = row_depth + (float)i * prim->depth.dx;
+        result->depths[i] = depth;
+
+        if (row->test_depth && !(depth >= 0.f)) {
+            covered = false;
+        }
+
+        if (row->depth_values && !(depth <= row->depth_values[i])) {
+            covered = false;
+        }
+
+        if (covered) {
+            mask |= 1 << i;
+        }
+    }
+
+    return mask;
+}
+
+#ifdef RASTER_KERNELS_X86
+
+// 4 lanes at a time, twice
+__attribute__((target("sse2"))) static uint32_t raster_row_sse2(const struct raster_row* row,
+                                                                struct raster_row_result* result) {
+    const struct primitive* prim = row->prim;
+
+    __m128 row_depth = _mm_set1_ps(row_start_depth(row));
+    __m128 depth_dx = _mm_set1_ps(prim->depth.dx);
+
+    // lanes past the end of the row may read garbage, they get masked off anyway
+    float closest[BLOCK_SIZE];
+    if (row->depth_values) {
+        memcpy(closest, row->depth_values, row->width * sizeof(float));
+    }
+
+    uint32_t mask = 0;
+    for (uint32_t base = 0; base < row->width; base += 4) {
+        __m128 lanes = _mm_add_ps(_mm_set_ps(3.f, 2.f, 1.f, 0.f), _mm_set1_ps((float)base));
+        __m128 live = _mm_cmplt_ps(lanes, _mm_set1_ps((float)row->width));
+
+        // edges crossing the block are small enough to be tested in 32 bits
+        for (uint8_t j = 0; j < row->vertices; j++) {
+            if ((row->coverage_edges & (1 << j)) == 0) {
+                continue;
+            }
+
+            int32_t a = prim->edges[j].a;
+            int32_t start = (int32_t)(row->values[j] + (int64_t)a * base);
+
+            __m128i steps = _mm_set_epi32(3 * a, 2 * a, a, 0);
+            __m128i value = _mm_add_epi32(_mm_set1_epi32(start), steps);
+
+            __m128i inside = _mm_cmpgt_epi32(value, _mm_setzero_si128());
+            live = _mm_and_ps(live, _mm_castsi128_ps(inside));
+        }
+
+        __m128 depth = _mm_add_ps(row_depth, _mm_mul_ps(lanes, depth_dx));
+        _mm_storeu_ps(&result->depths[base], depth);
+
+        if (row->test_depth) {
+            live = _mm_and_ps(live, _mm_cmpge_ps(depth, _mm_setzero_ps()));
+        }
+
+        if (row->depth_values) {
+            __m128 closest_depth = _mm_loadu_ps(&closest[base]);
+            live = _mm_and_ps(live, _mm_cmple_ps(depth, closest_depth));
+        }
+
+        mask |= (uint32_t)_mm_movemask_ps(live) << base;
+    }
+
+    return mask;
+}
+
+// a whole block row in one go
+__attribute__((target("avx2"))) static uint32_t raster_row_avx2(const struct raster_row* row,
+                                                                struct raster_row_result* result) {
+    const struct primitive* prim = row->prim;
+
+    __m256i lane_indices = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    __m256 lanes = _mm256_cvtepi32_ps(lane_indices);
+
+    __m256 live = _mm256_cmp_ps(lanes, _mm256_set1_ps((float)row->width), _CMP_LT_OQ);
+
+    // edges crossing the block are small enough to be tested in 32 bits
+    for (uint8_t j = 0; j < row->vertices; j++) {
+        if ((row->coverage_edges & (1 << j)) == 0) {
+            continue;
+        }
+
+        __m256i steps = _mm256_mullo_epi32(lane_indices, _mm256_set1_epi32(prim->edges[j].a));
+        __m256i value = _mm256_add_epi32(_mm256_set1_epi32((int32_t)row->values[j]), steps);
+
+        __m256i inside = _mm256_cmpgt_epi32(value, _mm256_setzero_si256());
+        live = _mm256_and_ps(live, _mm256_castsi256_ps(inside));
+    }
+
+    __m256 row_depth = _mm256_set1_ps(row_start_depth(row));
+    __m256 depth_dx = _mm256_set1_ps(prim->depth.dx);
+
+    __m256 depth = _mm256_add_ps(row_depth, _mm256_mul_ps(lanes, depth_dx));
+    _mm256_storeu_ps(result->depths, depth);
+
+    if (row->test_depth) {
+        live = _mm256_and_ps(live, _mm256_cmp_ps(depth, _mm256_setzero_ps(), _CMP_GE_OQ));
+    }
+
+    if (row->depth_values) {
+        // masked load, so that we never read past the end of the depth buffer
+        __m256i load_mask = _mm256_castps_si256(live);
+        __m256 closest_depth = _mm256_maskload_ps(row->depth_values, load_mask);
+
+        live = _mm256_and_ps(live, _mm256_cmp_ps(depth, closest_depth, _CMP_LE_OQ));
+    }
+
+    return (uint32_t)_mm256_movemask_ps(live);
+}
+
+#endif
+
+raster_row_kernel raster_select_row_kernel() {
+#ifdef RASTER_KERNELS_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return raster_row_avx2;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return raster_row_sse2;
+    }
+#endif
+
+    return raster_row_scalar;
+}
@@ -1,42 +1,110 @@
 #include "rasterizer.h"
+#include "rasterizer_internal.h"
 
+#include "core/fence.h"
+#include "core/list.h"
 #include "core/mem.h"
 #include "core/thread_worker.h"
-#include "core/semaphore.h"
-#include "math/vec.h"
 #include "math/geo.h"
 #include "graphics/image.h"
 #include "debug/capture.h"
 
 #include <math.h>
+#include <pthread.h>
 #include <string.h>
 
+// primitives are binned into TILE_SIZE x TILE_SIZE screen tiles
+#define TILE_SIZE 64
+
+// scratch slots are padded to this, so that threads don't share cache lines
+#define SCRATCH_ALIGNMENT 64
+
+// the frame arena starts out this big, and grows as needed
+#define FRAME_ARENA_BLOCK_SIZE (1 << 20)
+
+// the vertex stage is split into chunks of at most VERTEX_CHUNK_SIZE vertices
+#define VERTEX_CHUNK_SIZE 256
+
+// clears are split into chunks of this many rows
+#define CLEAR_CHUNK_ROWS 16
+
+// depth bounds of primitives come from plane math that doesn't match the per-pixel depths to the
+// last bit, so they are only trusted to within this much
+#define DEPTH_BOUND_SLACK (1.f / 65536.f)
+
+// primitives reaching at most this many pixels past the edges of the framebuffer are scissored
+// instead of clipped. framebuffer size plus guard band has to stay within snapped coordinates
+#define GUARD_BAND_PIXELS 8192
+
+// clipping a primitive against the near plane and all four guard band planes adds a vertex each
+#define MAX_CLIPPED_VERTICES (MAX_PRIMITIVE_VERTICES + 5)
+
+// clipped polygons are drawn as triangle fans
+#define MAX_CLIPPED_PRIMITIVES (MAX_CLIPPED_VERTICES - 2)
+
+struct tile_bin {
+    struct rect rect;
+
+    // context of the first call of the batch. only what every call of a batch shares is read from
+    // it: the framebuffer, the pending clear and the scratch memory
+    const struct render_context* rc;
+
+    // in submission order. every primitive points to the context of its own call
+    const struct primitive** primitives;
+    uint32_t primitive_count, capacity;
+
+    // the pending clear of the rasterizer hasn't been written to this tile yet
+    bool clear_pending;
+};
+
 struct rasterizer {
     thread_worker_t* worker;
-    uint32_t num_scanlines;
+
+    // either the shared worker, or one owned by the caller
+    bool shared_worker;
+
     capture_t* current_capture;
-};
 
-struct vertex_output {
-    void* working_data;
-    float position[4];
-};
+    uint32_t tiles_x, tiles_y;
+    struct tile_bin* bins;
 
-struct render_context {
-    const struct pipeline* pipeline;
-    struct framebuffer* fb;
+    raster_row_kernel row_kernel;
 
-    struct vertex_output* outputs;
-    uint8_t vertices;
+    // reused by every call, only ever grows
+    void* scratch;
+    size_t scratch_size;
+
+    // transient data of calls in flight. reset every frame
+    mem_arena_t* frame_arena;
+
+    // clear recorded in the command buffer being executed, written to each tile by the first call
+    // that touches it, and to the rest once the command buffer is done
+    const struct framebuffer* pending_clear_fb;
+    const image_pixel* pending_clear_values;
+
+    // submitted command buffers run in order on the executor, which is started on first submit
+    pthread_t executor;
+    bool executor_running, executor_busy, executor_stopping;
 
-    uint32_t instance_id;
-    void* uniform_data;
+    // guards everything below and the executor flags
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t queue_signal, idle_signal;
 
-    semaphore_t* semaphore;
+    // struct submission*
+    struct list queue;
 };
 
+struct submission {
+    const command_buffer_t* cmd;
+    fence_t* fence;
+
+    // captures are decided on submit, not on execution
+    capture_t* capture;
+};
+
+// factors are out of 0xFF
 struct blend_context {
-    float src_alpha, dst_alpha;
+    uint32_t src_alpha, dst_alpha;
 };
 
 static image_pixel image_get_pixel(const image_t* image, uint32_t x, uint32_t y) {
@@ -60,131 +128,545 @@ static void image_set_pixel(image_t* image, uint32_t x, uint32_t y, const image_
     memcpy(pixel_address, value, image->pixel_stride);
 }
 
-static void framebuffer_fill_attachment(image_t* attachment, const image_pixel* value) {
-    for (uint32_t y = 0; y < attachment->height; y++) {
-        for (uint32_t x = 0; x < attachment->width; x++) {
-            image_set_pixel(attachment, x, y, value);
+// every format is 32 bits wide, so clear values can be written a word at a time
+static void image_fill_rect(image_t* image, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+                            const image_pixel* value) {
+    x1 = x1 < image->width ? x1 : image->width;
+    y1 = y1 < image->height ? y1 : image->height;
+
+    for (uint32_t y = y0; y < y1; y++) {
+        uint32_t* row = (uint32_t*)image->data + image_get_pixel_index(image, x0, y);
+
+        for (uint32_t x = 0; x < x1 - x0; x++) {
+            row[x] = value->color;
         }
     }
 }
 
-void framebuffer_clear(rasterizer_t* rast, struct framebuffer* fb,
-                       const image_pixel* clear_values) {
-    for (uint32_t i = 0; i < fb->attachment_count; i++) {
-        image_t* attachment = fb->attachments[i];
-        framebuffer_fill_attachment(attachment, &clear_values[i]);
+// farthest depth of every block and tile of a depth image, so that primitives behind everything
+// already drawn can be rejected without touching any pixels
+struct depth_hierarchy {
+    uint32_t blocks_x, blocks_y;
+    uint32_t tiles_x, tiles_y;
+
+    float* block_depths;
+    float* tile_depths;
+};
+
+static struct depth_hierarchy* depth_hierarchy_alloc(const image_t* image) {
+    uint32_t blocks_x = (image->width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t blocks_y = (image->height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t tiles_x = (image->width + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t tiles_y = (image->height + TILE_SIZE - 1) / TILE_SIZE;
+
+    // freed by image_free, so everything goes in one allocation
+    size_t depths_size = sizeof(float) * (blocks_x * blocks_y + tiles_x * tiles_y);
+    size_t size = sizeof(struct depth_hierarchy) + depths_size;
+
+    struct depth_hierarchy* hierarchy = mem_alloc_tagged(size, MEM_TAG_RASTERIZER);
+    hierarchy->blocks_x = blocks_x;
+    hierarchy->blocks_y = blocks_y;
+    hierarchy->tiles_x = tiles_x;
+    hierarchy->tiles_y = tiles_y;
+
+    hierarchy->block_depths = (float*)(hierarchy + 1);
+    hierarchy->tile_depths = hierarchy->block_depths + blocks_x * blocks_y;
+
+    return hierarchy;
+}
+
+static void depth_hierarchy_update_block(struct depth_hierarchy* hierarchy, const image_t* image,
+                                         uint32_t block_x, uint32_t block_y) {
+    uint32_t x0 = block_x * BLOCK_SIZE;
+    uint32_t y0 = block_y * BLOCK_SIZE;
+    uint32_t x1 = x0 + BLOCK_SIZE < image->width ? x0 + BLOCK_SIZE : image->width;
+    uint32_t y1 = y0 + BLOCK_SIZE < image->height ? y0 + BLOCK_SIZE : image->height;
+
+    const float* depths = image->data;
+    float max_depth = -INFINITY;
+
+    for (uint32_t y = y0; y < y1; y++) {
+        const float* row = depths + image_get_pixel_index(image, 0, y);
+
+        for (uint32_t x = x0; x < x1; x++) {
+            max_depth = row[x] > max_depth ? row[x] : max_depth;
+        }
+    }
+
+    hierarchy->block_depths[block_y * hierarchy->blocks_x + block_x] = max_depth;
+}
+
+static void depth_hierarchy_update_tile(struct depth_hierarchy* hierarchy, uint32_t tile_x,
+                                        uint32_t tile_y) {
+    const uint32_t blocks_per_tile = TILE_SIZE / BLOCK_SIZE;
+
+    uint32_t bx0 = tile_x * blocks_per_tile;
+    uint32_t by0 = tile_y * blocks_per_tile;
+    uint32_t bx1 = bx0 + blocks_per_tile;
+    uint32_t by1 = by0 + blocks_per_tile;
+
+    bx1 = bx1 < hierarchy->blocks_x ? bx1 : hierarchy->blocks_x;
+    by1 = by1 < hierarchy->blocks_y ? by1 : hierarchy->blocks_y;
+
+    float max_depth = -INFINITY;
+    for (uint32_t by = by0; by < by1; by++) {
+        const float* row = &hierarchy->block_depths[by * hierarchy->blocks_x];
+
+        for (uint32_t bx = bx0; bx < bx1; bx++) {
+            max_depth = row[bx] > max_depth ? row[bx] : max_depth;
+        }
+    }
+
+    hierarchy->tile_depths[tile_y * hierarchy->tiles_x + tile_x] = max_depth;
+}
+
+// builds the hierarchy from scratch if the image doesn't have one yet
+static struct depth_hierarchy* depth_hierarchy_get(image_t* image) {
+    if (image->depth_hierarchy) {
+        return image->depth_hierarchy;
+    }
+
+    struct depth_hierarchy* hierarchy = depth_hierarchy_alloc(image);
+    for (uint32_t by = 0; by < hierarchy->blocks_y; by++) {
+        for (uint32_t bx = 0; bx < hierarchy->blocks_x; bx++) {
+            depth_hierarchy_update_block(hierarchy, image, bx, by);
+        }
+    }
+
+    for (uint32_t ty = 0; ty < hierarchy->tiles_y; ty++) {
+        for (uint32_t tx = 0; tx < hierarchy->tiles_x; tx++) {
+            depth_hierarchy_update_tile(hierarchy, tx, ty);
+        }
+    }
+
+    image->depth_hierarchy = hierarchy;
+    return hierarchy;
+}
+
+static void depth_hierarchy_fill(image_t* image, float depth) {
+    if (!image->depth_hierarchy) {
+        image->depth_hierarchy = depth_hierarchy_alloc(image);
+    }
+
+    struct depth_hierarchy* hierarchy = image->depth_hierarchy;
+    uint32_t depth_count = hierarchy->blocks_x * hierarchy->blocks_y;
+    depth_count += hierarchy->tiles_x * hierarchy->tiles_y;
+
+    // tile depths directly follow block depths
+    for (uint32_t i = 0; i < depth_count; i++) {
+        hierarchy->block_depths[i] = depth;
+    }
+}
+
+// true if nothing at or beyond min_depth can pass a depth test against max_depth
+static bool depth_bound_rejects(float min_depth, float max_depth) {
+    return min_depth - DEPTH_BOUND_SLACK > max_depth;
+}
+
+// marks indices that no primitive of the call references
+#define VERTEX_SLOT_UNUSED UINT32_MAX
+
+// indices are mapped to slots through a table indexed by index - min_index, unless that would take
+// more than this many entries per index. sparse indices are hashed instead
+#define VERTEX_CACHE_MAX_SPAN_RATIO 4
+
+// post-transform vertices of a call. every index the call references is shaded exactly once per
+// instance, and primitives refer to the results instead of shading their own copies
+struct vertex_cache {
+    // maps index - min_index to a slot, or VERTEX_SLOT_UNUSED. if keys isn't NULL, it's an open
+    // addressing hash table instead, where slots[i] is the slot of keys[i]
+    uint32_t* slots;
+    uint32_t min_index;
+
+    uint32_t* keys;
+    uint32_t hash_mask, hash_shift;
+
+    // index value of each slot, in order of first reference
+    uint32_t* slot_indices;
+    uint32_t slot_count;
+
+    // slot_count outputs per instance
+    struct vertex_output* outputs;
+    void* working_data;
+};
+
+// position of index in the hash table of the cache, or of the free entry where it would go
+static uint32_t vertex_cache_probe(const struct vertex_cache* cache, uint32_t index) {
+    // fibonacci hashing. the top bits of the product depend on every bit of the index, so strided
+    // indices don't all land on the same entries
+    uint32_t position = (uint32_t)(index * 2654435769u) >> cache->hash_shift;
+
+    while (cache->slots[position] != VERTEX_SLOT_UNUSED && cache->keys[position] != index) {
+        position = (position + 1) & cache->hash_mask;
+    }
+
+    return position;
+}
+
+static void vertex_cache_init(struct vertex_cache* cache, const struct indexed_render_call* data,
+                              const uint32_t* indices, uint32_t index_count, mem_arena_t* arena) {
+    uint32_t min_index = UINT32_MAX;
+    uint32_t max_index = 0;
+    for (uint32_t i = 0; i < index_count; i++) {
+        uint32_t index = indices[i];
+
+        min_index = index < min_index ? index : min_index;
+        max_index = index > max_index ? index : max_index;
+    }
+
+    cache->min_index = min_index;
+    cache->keys = NULL;
+    cache->slot_count = 0;
+
+    if (index_count == 0) {
+        cache->slots = NULL;
+        cache->slot_indices = NULL;
+        cache->outputs = NULL;
+        cache->working_data = NULL;
+
+        return;
+    }
+
+    // 0 and UINT32_MAX in the same call take 2^32 entries
+    uint64_t span = (uint64_t)max_index - min_index + 1;
+    bool direct = span <= UINT32_MAX && span <= (uint64_t)index_count * VERTEX_CACHE_MAX_SPAN_RATIO;
+
+    uint32_t table_size;
+    if (direct) {
+        table_size = (uint32_t)span;
+    } else {
+        // at most half full, so that probes stay short
+        cache->hash_shift = 32;
+        while (((uint64_t)1 << (32 - cache->hash_shift)) < (uint64_t)index_count * 2) {
+            cache->hash_shift--;
+        }
+
+        table_size = (uint32_t)1 << (32 - cache->hash_shift);
+        cache->hash_mask = table_size - 1;
+        cache->keys = mem_arena_alloc(arena, sizeof(uint32_t) * table_size);
+    }
+
+    cache->slots = mem_arena_alloc(arena, sizeof(uint32_t) * table_size);
+    for (uint32_t i = 0; i < table_size; i++) {
+        cache->slots[i] = VERTEX_SLOT_UNUSED;
+    }
+
+    // there can't be more distinct indices than either of these
+    uint32_t max_slots = direct && table_size < index_count ? table_size : index_count;
+    cache->slot_indices = mem_arena_alloc(arena, sizeof(uint32_t) * max_slots);
+
+    for (uint32_t i = 0; i < index_count; i++) {
+        uint32_t index = indices[i];
+
+        uint32_t position = direct ? index - min_index : vertex_cache_probe(cache, index);
+        uint32_t* slot = &cache->slots[position];
+
+        if (*slot == VERTEX_SLOT_UNUSED) {
+            *slot = cache->slot_count++;
+            cache->slot_indices[*slot] = index;
+
+            if (!direct) {
+                cache->keys[position] = index;
+            }
+        }
+    }
+
+    size_t working_size = data->pipeline->shader.working_size;
+    uint32_t output_count = cache->slot_count * data->instance_count;
+
+    cache->outputs = mem_arena_alloc(arena, sizeof(struct vertex_output) * output_count);
+    cache->working_data = mem_arena_alloc(arena, working_size * output_count);
+
+    for (uint32_t i = 0; i < output_count; i++) {
+        cache->outputs[i].working_data = cache->working_data + working_size * i;
     }
+}
+
+static const struct vertex_output* vertex_cache_get(const struct vertex_cache* cache,
+                                                    uint32_t instance, uint32_t index) {
+    uint32_t position = cache->keys ? vertex_cache_probe(cache, index) : index - cache->min_index;
+    uint32_t slot = cache->slots[position];
 
-    if (rast->current_capture) {
-        capture_add_framebuffer_clear(rast->current_capture, fb, clear_values);
+    return &cache->outputs[instance * cache->slot_count + slot];
+}
+
+// outcode bits of a clip space position. the first six are the view volume, the rest are the guard
+// band, which only matters for clipping
+typedef enum {
+    CLIP_X_MIN = 1 << 0,
+    CLIP_X_MAX = 1 << 1,
+    CLIP_Y_MIN = 1 << 2,
+    CLIP_Y_MAX = 1 << 3,
+    CLIP_NEAR = 1 << 4,
+    CLIP_FAR = 1 << 5,
+    CLIP_GUARD_X_MIN = 1 << 6,
+    CLIP_GUARD_X_MAX = 1 << 7,
+    CLIP_GUARD_Y_MIN = 1 << 8,
+    CLIP_GUARD_Y_MAX = 1 << 9,
+} clip_plane;
+
+#define CLIP_VIEW_VOLUME (CLIP_X_MIN | CLIP_X_MAX | CLIP_Y_MIN | CLIP_Y_MAX | CLIP_NEAR | CLIP_FAR)
+
+// everything else is either inside or left to the scissor and the depth test
+#define CLIP_PLANES                                                                                \
+    (CLIP_NEAR | CLIP_GUARD_X_MIN | CLIP_GUARD_X_MAX | CLIP_GUARD_Y_MIN | CLIP_GUARD_Y_MAX)
+
+static uint32_t clip_outcode(const struct render_context* rc, const float* position) {
+    float x = position[0];
+    float y = position[1];
+    float z = position[2];
+    float w = position[3];
+
+    uint32_t code = 0;
+    code |= x < -w ? CLIP_X_MIN : 0;
+    code |= x > w ? CLIP_X_MAX : 0;
+    code |= y < -w ? CLIP_Y_MIN : 0;
+    code |= y > w ? CLIP_Y_MAX : 0;
+    code |= z < -w ? CLIP_NEAR : 0;
+    code |= z > w ? CLIP_FAR : 0;
+    code |= x < -rc->guard_x * w ? CLIP_GUARD_X_MIN : 0;
+    code |= x > rc->guard_x * w ? CLIP_GUARD_X_MAX : 0;
+    code |= y < -rc->guard_y * w ? CLIP_GUARD_Y_MIN : 0;
+    code |= y > rc->guard_y * w ? CLIP_GUARD_Y_MAX : 0;
+
+    return code;
+}
+
+// outcode and perspective divide, done once per vertex
+static void project_vertex(const struct render_context* rc, struct vertex_output* output) {
+    const float* position = output->position;
+    output->clip_code = clip_outcode(rc, position);
+
+    if (!(position[3] > 0.f)) {
+        return;
     }
+
+    float inverse_w = 1.f / position[3];
+    output->projected[0] = position[0] * inverse_w;
+    output->projected[1] = position[1] * inverse_w;
+    output->projected[2] = position[2] * inverse_w * 0.5f + 0.5f;
+    output->projected[3] = inverse_w;
 }
 
-static void process_face_vertices(const struct indexed_render_call* data, uint32_t instance,
-                                  uint32_t face, uint8_t indices, struct vertex_output* outputs,
-                                  struct captured_primitive* captured) {
+static void shade_vertex(const struct indexed_render_call* data, uint32_t instance,
+                         uint32_t vertex_index, struct vertex_output* output) {
     struct shader_context context;
+    context.vertex_index = vertex_index;
     context.instance_index = instance;
     context.uniform_data = data->uniform_data;
-    context.working_data = NULL;
+    context.working_data = output->working_data;
+    memset(context.quad_working_data, 0, sizeof(context.quad_working_data));
 
-    size_t working_size = data->pipeline->shader.working_size;
-    if (captured) {
-        captured->indices = mem_alloc(sizeof(uint32_t) * indices);
-        captured->working_data = mem_alloc(working_size * indices);
-        captured->vertex_positions = mem_alloc(sizeof(float) * 4 * indices);
-        captured->instance_index = instance;
+    const void* vertex_data[data->pipeline->binding_count];
+    for (uint32_t i = 0; i < data->pipeline->binding_count; i++) {
+        const struct vertex_binding* binding = &data->pipeline->bindings[i];
+        const struct vertex_buffer* vbuf = &data->vertices[i];
+
+        uint32_t buffer_index;
+        switch (binding->input_rate) {
+        case VERTEX_INPUT_RATE_VERTEX:
+            buffer_index = vertex_index;
+            break;
+        case VERTEX_INPUT_RATE_INSTANCE:
+            buffer_index = instance;
+            break;
+        }
+
+        size_t offset = buffer_index * binding->stride;
+        vertex_data[i] = vbuf->data + offset;
     }
 
-    const void* vertex_data[data->pipeline->binding_count];
-    for (uint8_t i = 0; i < indices; i++) {
-        uint32_t index_id = data->first_index + face * indices + i;
-        context.vertex_index = data->vertex_offset + data->indices[index_id];
+    memset(output->position, 0, 4 * sizeof(float));
+    output->position[3] = 1.f;
 
-        for (uint32_t j = 0; j < data->pipeline->binding_count; j++) {
-            const struct vertex_binding* binding = &data->pipeline->bindings[j];
-            const struct vertex_buffer* vbuf = &data->vertices[j];
+    data->pipeline->shader.vertex_stage(vertex_data, &context, output->position);
+}
 
-            uint32_t buffer_index;
-            switch (binding->input_rate) {
-            case VERTEX_INPUT_RATE_VERTEX:
-                buffer_index = context.vertex_index;
-                break;
-            case VERTEX_INPUT_RATE_INSTANCE:
-                buffer_index = instance;
-                break;
-            }
+// index values of every face of a call, with strips and fans already unrolled into triangles
+struct face_list {
+    uint32_t* indices;
+    uint32_t face_count;
+    uint8_t vertices_per_face;
+};
+
+// one call of a batch, from face assembly until its primitives are binned
+struct draw {
+    const struct indexed_render_call* data;
+    struct render_context rc;
+
+    struct face_list faces;
+    struct vertex_cache cache;
+};
+
+// the vertices of every draw of a batch, counted across draws
+struct vertex_stage {
+    struct draw* draws;
+    uint32_t draw_count;
+
+    // index of the first vertex of each draw, followed by the total
+    uint32_t* offsets;
+};
 
-            size_t offset = buffer_index * binding->stride;
-            vertex_data[j] = vbuf->data + offset;
+// shades a range of the cached vertices of a batch, counted across draws and instances
+static void process_vertex_range(void* user_data, uint32_t begin, uint32_t end) {
+    const struct vertex_stage* stage = user_data;
+
+    // last draw starting at or before begin
+    uint32_t low = 0;
+    uint32_t high = stage->draw_count - 1;
+
+    while (low < high) {
+        uint32_t middle = (low + high + 1) / 2;
+
+        if (stage->offsets[middle] <= begin) {
+            low = middle;
+        } else {
+            high = middle - 1;
         }
+    }
 
-        struct vertex_output* current_output = &outputs[i];
-        memset(current_output->position, 0, 4 * sizeof(float));
-        current_output->position[3] = 1.f;
+    for (uint32_t d = low; d < stage->draw_count && stage->offsets[d] < end; d++) {
+        const struct draw* draw = &stage->draws[d];
+        const struct indexed_render_call* data = draw->data;
+        const struct vertex_cache* cache = &draw->cache;
 
-        context.working_data = current_output->working_data;
-        data->pipeline->shader.vertex_stage(vertex_data, &context, current_output->position);
+        uint32_t draw_begin = stage->offsets[d];
+        uint32_t draw_end = stage->offsets[d + 1];
 
-        if (captured) {
-            captured->indices[i] = context.vertex_index;
+        uint32_t first = (begin > draw_begin ? begin : draw_begin) - draw_begin;
+        uint32_t last = (end < draw_end ? end : draw_end) - draw_begin;
+
+        for (uint32_t i = first; i < last; i++) {
+            uint32_t instance = i / cache->slot_count;
+            uint32_t slot = i % cache->slot_count;
+
+            uint32_t instance_id = data->first_instance + instance;
+            uint32_t vertex_index = data->vertex_offset + cache->slot_indices[slot];
 
-            memcpy(captured->working_data + i * working_size, context.working_data, working_size);
-            memcpy(captured->vertex_positions + i * 4, current_output->position, 4 * sizeof(float));
+            shade_vertex(data, instance_id, vertex_index, &cache->outputs[i]);
+            project_vertex(&draw->rc, &cache->outputs[i]);
         }
     }
 }
 
-static float signed_quad_area(const float* a, const float* b, const float* c, bool cw) {
-    float ab[2], ab_normal[2];
-    vec_sub(b, a, 2, ab);
-    vec_rot90(ab, ab_normal, cw);
+// widens the indices of a call to 32 bits, once per call
+static uint32_t* read_indices(const struct indexed_render_call* data, mem_arena_t* arena) {
+    uint32_t* result = mem_arena_alloc(arena, sizeof(uint32_t) * data->index_count);
+
+    if (!data->indices) {
+        for (uint32_t i = 0; i < data->index_count; i++) {
+            result[i] = i;
+        }
+
+        return result;
+    }
+
+    if (data->index_type == INDEX_TYPE_U32) {
+        const uint32_t* indices = (const uint32_t*)data->indices + data->first_index;
+        memcpy(result, indices, sizeof(uint32_t) * data->index_count);
+
+        return result;
+    }
 
-    float ac[2];
-    vec_sub(c, a, 2, ac);
+    const uint16_t* indices = (const uint16_t*)data->indices + data->first_index;
+    for (uint32_t i = 0; i < data->index_count; i++) {
+        result[i] = indices[i];
+    }
 
-    return vec_dot(ac, ab_normal, 2);
+    return result;
 }
 
-static bool face_contains_point(bool cw, bool cull_back, const struct vertex_output* outputs,
-                                uint8_t vertices, const float* point, float* weights) {
-    float area_sum = 0.f;
-    float areas[vertices];
+static void face_list_init(struct face_list* faces, const struct indexed_render_call* data,
+                           uint8_t vertices_per_face, mem_arena_t* arena) {
+    const uint32_t* indices = read_indices(data, arena);
+    uint32_t index_count = data->index_count;
 
-    for (uint8_t i = 0; i < vertices; i++) {
-        const float* a = outputs[i].position;
+    topology_type topology = data->pipeline->topology;
+    bool connected =
+        topology == TOPOLOGY_TYPE_TRIANGLE_STRIP || topology == TOPOLOGY_TYPE_TRIANGLE_FAN;
 
-        uint8_t next_vertex_id = (i + 1) % vertices;
-        const float* b = outputs[next_vertex_id].position;
+    faces->vertices_per_face = vertices_per_face;
 
-        float area = signed_quad_area(a, b, point, cw);
-        if (cull_back && area <= 0.f) {
-            return false;
-        }
+    // lists are taken as they are, any indices past the last whole face are ignored
+    if (!connected) {
+        faces->indices = (uint32_t*)indices;
+        faces->face_count = index_count / vertices_per_face;
 
-        area_sum += area;
-        areas[(i + 2) % vertices] = area;
+        return;
     }
 
-    if (area_sum <= 0) {
-        area_sum *= -1.f;
-    }
+    uint32_t restart_index = data->index_type == INDEX_TYPE_U32 ? UINT32_MAX : UINT16_MAX;
+    bool restart = data->pipeline->primitive_restart && data->indices;
 
-    bool first_out = areas[0] <= 0.f;
-    for (uint8_t i = 0; i < vertices; i++) {
-        if (weights) {
-            weights[i] = areas[i] / area_sum;
+    // every index after the first two of a run makes a new triangle
+    uint32_t max_faces = index_count > 2 ? index_count - 2 : 0;
+    faces->indices = mem_arena_alloc(arena, sizeof(uint32_t) * 3 * max_faces);
+    faces->face_count = 0;
+
+    uint32_t run_length = 0;
+    uint32_t first = 0, previous = 0;
+
+    for (uint32_t i = 0; i < index_count; i++) {
+        uint32_t index = indices[i];
+        if (restart && index == restart_index) {
+            run_length = 0;
+            continue;
         }
 
-        if (i > 0 && !cull_back) {
-            bool current_out = areas[i] <= 0.f;
-            if (first_out != current_out) {
-                return false;
+        if (run_length >= 2) {
+            uint32_t* face = &faces->indices[faces->face_count++ * 3];
+
+            // every other triangle of a strip is flipped, so that they all share a winding
+            if (topology == TOPOLOGY_TYPE_TRIANGLE_STRIP && run_length % 2 == 1) {
+                face[0] = previous;
+                face[1] = first;
+            } else {
+                face[0] = first;
+                face[1] = previous;
             }
+
+            face[2] = index;
+        }
+
+        // strips slide along, fans keep their first vertex
+        if (run_length == 0 || topology == TOPOLOGY_TYPE_TRIANGLE_STRIP) {
+            first = run_length == 0 ? index : previous;
         }
+
+        previous = index;
+        run_length++;
     }
+}
 
-    return true;
+static void assemble_face(const struct indexed_render_call* data, const struct vertex_cache* cache,
+                          const struct face_list* faces, uint32_t instance, uint32_t face,
+                          struct vertex_output* outputs, struct captured_primitive* captured) {
+    uint8_t indices = faces->vertices_per_face;
+
+    size_t working_size = data->pipeline->shader.working_size;
+    if (captured) {
+        captured->indices = mem_alloc_tagged(sizeof(uint32_t) * indices, MEM_TAG_CAPTURE);
+        captured->working_data = mem_alloc_tagged(working_size * indices, MEM_TAG_CAPTURE);
+        captured->vertex_positions =
+            mem_alloc_tagged(sizeof(float) * 4 * indices, MEM_TAG_CAPTURE);
+        captured->instance_index = data->first_instance + instance;
+    }
+
+    for (uint8_t i = 0; i < indices; i++) {
+        uint32_t index = faces->indices[face * indices + i];
+
+        // the working data pointer is shared with every other primitive using this vertex
+        outputs[i] = *vertex_cache_get(cache, instance, index);
+
+        if (captured) {
+            captured->indices[i] = data->vertex_offset + index;
+
+            memcpy(captured->working_data + i * working_size, outputs[i].working_data,
+                   working_size);
+
+            memcpy(captured->vertex_positions + i * 4, outputs[i].position, 4 * sizeof(float));
+        }
+    }
 }
 
 static size_t parameter_element_stride(element_type type) {
@@ -198,109 +680,88 @@ static size_t parameter_element_stride(element_type type) {
     }
 }
 
-static void shader_blend_parameters(const struct shader* shader,
-                                    const struct vertex_output* outputs, uint8_t indices,
-                                    const float* weights, float current_depth, void* result) {
+static uint32_t shader_count_components(const struct shader* shader) {
+    uint32_t count = 0;
     for (uint32_t i = 0; i < shader->inter_stage_parameter_count; i++) {
-        const struct blended_parameter* parameter = &shader->inter_stage_parameters[i];
-
-        size_t stride = parameter_element_stride(parameter->type);
-        for (uint32_t j = 0; j < parameter->count; j++) {
-            size_t buffer_offset = parameter->offset + j * stride;
-
-            float result_value = 0.f;
-            for (uint8_t k = 0; k < indices; k++) {
-                const void* source_data = outputs[k].working_data + buffer_offset;
-
-                float vertex_value;
-                switch (parameter->type) {
-                case ELEMENT_TYPE_BYTE:
-                    vertex_value = (float)*(uint8_t*)source_data;
-                    break;
-                case ELEMENT_TYPE_FLOAT:
-                    vertex_value = *(float*)source_data;
-                    break;
-                }
-
-                float weight = weights[k];
-                float depth = outputs[k].position[2];
-
-                result_value += vertex_value * weight / depth;
-            }
-
-            result_value *= current_depth;
-
-            void* destination_data = result + buffer_offset;
-            switch (parameter->type) {
-            case ELEMENT_TYPE_BYTE:
-                *(uint8_t*)destination_data = (uint8_t)result_value;
-                break;
-            case ELEMENT_TYPE_FLOAT:
-                *(float*)destination_data = result_value;
-                break;
-            }
-        }
+        count += shader->inter_stage_parameters[i].count;
     }
+
+    return count;
 }
 
-static bool pre_fragment_tests(const struct pipeline* pipeline, struct framebuffer* fb, uint32_t x,
-                               uint32_t y, float current_depth) {
-    if (pipeline->depth.test && current_depth < 0.f) {
-        return false;
-    }
+static float plane_evaluate(const struct attribute_plane* plane, float offset_x, float offset_y) {
+    return plane->origin + plane->dy * offset_y + plane->dx * offset_x;
+}
 
-    for (uint32_t i = 0; i < fb->attachment_count; i++) {
-        image_t* attachment = fb->attachments[i];
+static void shader_blend_parameters(const struct shader* shader, const struct primitive* prim,
+                                    uint32_t x, uint32_t y, void* result) {
+    float offset_x = (float)((int32_t)x - prim->origin_x);
+    float offset_y = (float)((int32_t)y - prim->origin_y);
 
-        switch (attachment->format) {
-        case IMAGE_FORMAT_DEPTH:
-            if (pipeline->depth.test) {
-                const float* depth_data = attachment->data;
+    float w = 1.f;
+    if (!shader->linear_interpolation) {
+        w = 1.f / plane_evaluate(&prim->inverse_w, offset_x, offset_y);
+    }
 
-                uint32_t index = image_get_pixel_index(attachment, x, y);
-                float closest_depth = depth_data[index];
+    const struct attribute_plane* plane = prim->planes;
+    for (uint32_t i = 0; i < shader->inter_stage_parameter_count; i++) {
+        const struct blended_parameter* parameter = &shader->inter_stage_parameters[i];
+        void* destination = result + parameter->offset;
 
-                if (current_depth > closest_depth) {
-                    return false;
-                }
+        switch (parameter->type) {
+        case ELEMENT_TYPE_BYTE:
+            for (uint32_t j = 0; j < parameter->count; j++) {
+                float value = plane_evaluate(plane++, offset_x, offset_y) * w;
+                ((uint8_t*)destination)[j] = (uint8_t)value;
             }
 
             break;
-        default:
-            // nothing
+        case ELEMENT_TYPE_FLOAT:
+            for (uint32_t j = 0; j < parameter->count; j++) {
+                float value = plane_evaluate(plane++, offset_x, offset_y) * w;
+                memcpy(destination + j * sizeof(float), &value, sizeof(float));
+            }
+
             break;
         }
     }
+}
 
-    return true;
+void shader_get_derivatives(const struct shader_context* context, size_t offset, uint32_t count,
+                            float* ddx, float* ddy) {
+    for (uint32_t i = 0; i < count; i++) {
+        float values[3];
+        for (uint32_t j = 0; j < 3; j++) {
+            memcpy(&values[j], context->quad_working_data[j] + offset + i * sizeof(float),
+                   sizeof(float));
+        }
+
+        ddx[i] = values[1] - values[0];
+        ddy[i] = values[2] - values[0];
+    }
 }
 
-static float get_blending_factor(blend_factor factor, const struct blend_context* bc) {
+static uint32_t get_blending_factor(blend_factor factor, const struct blend_context* bc) {
     switch (factor) {
     case BLEND_FACTOR_SRC_ALPHA:
         return bc->src_alpha;
     case BLEND_FACTOR_ONE_MINUS_SRC_ALPHA:
-        return 1.f - bc->src_alpha;
+        return 0xFF - bc->src_alpha;
     case BLEND_FACTOR_ONE:
-        return 1.f;
+        return 0xFF;
     case BLEND_FACTOR_ZERO:
     default:
-        return 0.f;
+        return 0;
     }
 }
 
+// every factor is a multiple of 1 / 0xFF, so blending is exact in integers
 static uint32_t blend_channel(uint8_t src, uint8_t dst, const struct blend_context* bc,
                               const struct component_blend_op* op) {
-    float src_factor = get_blending_factor(op->src_factor, bc);
-    float dst_factor = get_blending_factor(op->dst_factor, bc);
-
-    float src_val = (float)src / (float)0xFF;
-    float dst_val = (float)dst / (float)0xFF;
+    int32_t src_operand = (int32_t)(src * get_blending_factor(op->src_factor, bc));
+    int32_t dst_operand = (int32_t)(dst * get_blending_factor(op->dst_factor, bc));
 
-    float src_operand = src_val * src_factor;
-    float dst_operand = dst_val * dst_factor;
-
-    float result;
+    int32_t result;
     switch (op->op) {
     case BLEND_OP_ADD:
         result = src_operand + dst_operand;
@@ -312,11 +773,11 @@ static uint32_t blend_channel(uint8_t src, uint8_t dst, const struct blend_conte
         result = dst_operand - src_operand;
         break;
     default:
-        result = 0.f;
+        result = 0;
     }
 
-    result = result > 0.f ? result : 0.f;
-    return result > 1.f ? 0xFF : (uint8_t)(result * (float)0xFF);
+    result = result > 0 ? result / 0xFF : 0;
+    return result > 0xFF ? 0xFF : (uint32_t)result;
 }
 
 static uint32_t blend_pixel(uint32_t src, uint32_t dst, const struct blend_attachment* attachment) {
@@ -324,12 +785,9 @@ static uint32_t blend_pixel(uint32_t src, uint32_t dst, const struct blend_attac
         return src;
     }
 
-    uint8_t src_alpha = src & 0xFF;
-    uint8_t dst_alpha = dst & 0xFF;
-
     struct blend_context bc;
-    bc.src_alpha = (float)src_alpha / (float)0xFF;
-    bc.dst_alpha = (float)dst_alpha / (float)0xFF;
+    bc.src_alpha = src & 0xFF;
+    bc.dst_alpha = dst & 0xFF;
 
     uint32_t result = 0;
     for (uint32_t i = 0; i < 4; i++) {
@@ -345,41 +803,32 @@ static uint32_t blend_pixel(uint32_t src, uint32_t dst, const struct blend_attac
     return result;
 }
 
-static void render_pixel(uint32_t x, uint32_t y, const struct render_context* rc) {
-    float weights[rc->vertices];
-    float point[2];
+static void render_fragment(uint32_t x, uint32_t y, const struct render_context* rc,
+                            const struct primitive* prim, float depth, void* working_data) {
+    const struct shader* shader = &rc->pipeline->shader;
 
-    point[0] = ((float)x + 0.5f) / (float)rc->fb->width * 2.f - 1.f;
-    point[1] = ((float)y + 0.5f) / (float)rc->fb->height * 2.f - 1.f;
+    struct shader_context context;
+    context.instance_index = prim->instance_id;
+    context.uniform_data = rc->uniform_data;
+    context.working_data = working_data;
 
-    if (!face_contains_point(rc->pipeline->winding == WINDING_ORDER_CW, rc->pipeline->cull_back,
-                             rc->outputs, rc->vertices, point, weights)) {
-        return;
-    }
+    shader_blend_parameters(shader, prim, x, y, context.working_data);
 
-    float inverse_depth = 0.f;
-    for (uint8_t i = 0; i < rc->vertices; i++) {
-        inverse_depth += weights[i] / rc->outputs[i].position[2];
-    }
+    // the planes are defined everywhere, so pixels of the quad outside of the primitive get
+    // values too, like the helper lanes of a gpu
+    memset(context.quad_working_data, 0, sizeof(context.quad_working_data));
+    if (shader->derivatives) {
+        uint32_t quad_x = x & ~1u;
+        uint32_t quad_y = y & ~1u;
 
-    float depth = 1.f / inverse_depth;
-    if (!pre_fragment_tests(rc->pipeline, rc->fb, x, y, depth)) {
-        return;
+        for (uint32_t i = 0; i < 3; i++) {
+            void* quad_data = working_data + (i + 1) * rc->working_stride;
+            shader_blend_parameters(shader, prim, quad_x + (i == 1), quad_y + (i == 2), quad_data);
+
+            context.quad_working_data[i] = quad_data;
+        }
     }
 
-    struct shader_context context;
-    context.instance_index = rc->instance_id;
-    context.uniform_data = rc->uniform_data;
-
-    if (rc->pipeline->shader.working_size > 0) {
-        context.working_data = mem_alloc(rc->pipeline->shader.working_size);
-    } else {
-        context.working_data = NULL;
-    }
-
-    shader_blend_parameters(&rc->pipeline->shader, rc->outputs, rc->vertices, weights, depth,
-                            context.working_data);
-
     uint32_t src_color = rc->pipeline->shader.fragment_stage(&context);
     uint32_t blending_index = 0;
 
@@ -389,16 +838,21 @@ static void render_pixel(uint32_t x, uint32_t y, const struct render_context* rc
         bool discard = false;
         image_pixel value;
 
-        image_pixel dst = image_get_pixel(attachment, x, y);
         switch (attachment->format) {
         case IMAGE_FORMAT_COLOR:
             if (blending_index >= rc->pipeline->blend_attachment_count) {
                 value.color = src_color;
             } else {
-                const struct blend_attachment* attachment =
+                const struct blend_attachment* blending =
                     &rc->pipeline->blend_attachments[blending_index++];
 
-                value.color = blend_pixel(src_color, dst.color, attachment);
+                // the destination is only read if it is blended with
+                uint32_t dst_color = 0;
+                if (blending->enabled) {
+                    dst_color = image_get_pixel(attachment, x, y).color;
+                }
+
+                value.color = blend_pixel(src_color, dst_color, blending);
             }
 
             break;
@@ -421,65 +875,481 @@ static void render_pixel(uint32_t x, uint32_t y, const struct render_context* rc
 
         image_set_pixel(attachment, x, y, &value);
     }
+}
+
+static bool rect_intersect(const struct rect* a, const struct rect* b, struct rect* result) {
+    uint32_t x0 = a->x > b->x ? a->x : b->x;
+    uint32_t y0 = a->y > b->y ? a->y : b->y;
+
+    uint32_t a_x1 = a->x + a->width;
+    uint32_t a_y1 = a->y + a->height;
+    uint32_t b_x1 = b->x + b->width;
+    uint32_t b_y1 = b->y + b->height;
+
+    uint32_t x1 = a_x1 < b_x1 ? a_x1 : b_x1;
+    uint32_t y1 = a_y1 < b_y1 ? a_y1 : b_y1;
+
+    if (x1 <= x0 || y1 <= y0) {
+        return false;
+    }
 
-    mem_free(context.working_data);
+    result->x = x0;
+    result->y = y0;
+    result->width = x1 - x0;
+    result->height = y1 - y0;
+
+    return true;
 }
 
-struct scanline {
-    const struct render_context* rc;
-    const struct rect* scissor;
+// lower bound of the depth of prim over the pixels from (x0, y0) to (x1, y1), inclusive
+static float primitive_min_depth(const struct primitive* prim, uint32_t x0, uint32_t y0,
+                                 uint32_t x1, uint32_t y1) {
+    // depth is linear, so its smallest value over the rectangle is at one of the corners. it
+    // only ever gets smaller than the smallest vertex depth outside of the primitive
+    const struct attribute_plane* plane = &prim->depth;
+    float offset_x0 = (float)((int32_t)x0 - prim->origin_x);
+    float offset_y0 = (float)((int32_t)y0 - prim->origin_y);
+    float offset_x1 = (float)((int32_t)x1 - prim->origin_x);
+    float offset_y1 = (float)((int32_t)y1 - prim->origin_y);
+
+    float step_x0 = plane->dx * offset_x0;
+    float step_x1 = plane->dx * offset_x1;
+    float step_y0 = plane->dy * offset_y0;
+    float step_y1 = plane->dy * offset_y1;
+
+    float bound = plane->origin + (step_x0 < step_x1 ? step_x0 : step_x1) +
+                  (step_y0 < step_y1 ? step_y0 : step_y1);
+
+    return bound > prim->min_depth ? bound : prim->min_depth;
+}
 
-    uint32_t index;
-};
+// returns true if any depth was written
+static bool rasterize_block(const struct render_context* rc, const struct primitive* prim,
+                            uint32_t x0, uint32_t y0, uint32_t width, uint32_t height,
+                            void* working_data) {
+    struct depth_hierarchy* hierarchy = rc->depth_hierarchy;
+    uint32_t block_x = x0 / BLOCK_SIZE;
+    uint32_t block_y = y0 / BLOCK_SIZE;
+
+    // behind everything in the block already
+    if (hierarchy) {
+        float max_depth = hierarchy->block_depths[block_y * hierarchy->blocks_x + block_x];
+        float min_depth = primitive_min_depth(prim, x0, y0, x0 + width - 1, y0 + height - 1);
+
+        if (depth_bound_rejects(min_depth, max_depth)) {
+            return false;
+        }
+    }
+
+    struct raster_row row;
+    row.coverage_edges = 0;
+
+    for (uint8_t i = 0; i < prim->vertex_count; i++) {
+        const struct edge_function* edge = &prim->edges[i];
+
+        // the edge functions are linear, so their extremes are at the corners of the block
+        int64_t step_x = (int64_t)edge->a * (width - 1);
+        int64_t step_y = (int64_t)edge->b * (height - 1);
+
+        int64_t value = (int64_t)edge->a * x0 + (int64_t)edge->b * y0 + edge->c;
+        int64_t max_value = value + (step_x > 0 ? step_x : 0) + (step_y > 0 ? step_y : 0);
+        int64_t min_value = value + (step_x < 0 ? step_x : 0) + (step_y < 0 ? step_y : 0);
+
+        row.values[i] = value;
+
+        // rectangles cover all of their scissor, which blocks are already clipped to
+        if (prim->rectangle) {
+            continue;
+        }
+
+        // entirely outside of one edge
+        if (max_value <= 0) {
+            return false;
+        }
+
+        // edges that the block is entirely inside of don't need to be tested per pixel
+        if (min_value <= 0) {
+            row.coverage_edges |= 1 << i;
+        }
+    }
 
-void render_scanline(void* user_data, void* job) {
-    rasterizer_t* rast = user_data;
-    struct scanline* sl = job;
+    row.prim = prim;
+    row.vertices = prim->vertex_count;
+    row.x = x0;
+    row.width = width;
+    row.test_depth = rc->pipeline->depth.test;
 
-    for (uint32_t y_offset = sl->index; y_offset < sl->scissor->height;
-         y_offset += rast->num_scanlines) {
-        uint32_t y = sl->scissor->y + y_offset;
+    struct raster_row_result result;
+    bool rendered = false;
 
-        for (uint32_t x_offset = 0; x_offset < sl->scissor->width; x_offset++) {
-            uint32_t x = sl->scissor->x + x_offset;
+    for (uint32_t y = y0; y < y0 + height; y++) {
+        row.y = y;
+        row.depth_values = NULL;
 
-            render_pixel(x, y, sl->rc);
+        if (row.test_depth && rc->depth_attachment) {
+            const float* depth_data = rc->depth_attachment->data;
+            row.depth_values = depth_data + image_get_pixel_index(rc->depth_attachment, x0, y);
         }
+
+        // only pixels that passed coverage and depth tests make it to the fragment stage
+        uint32_t mask = rc->row_kernel(&row, &result);
+        rendered |= mask != 0;
+
+        while (mask != 0) {
+            uint32_t lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            render_fragment(x0 + lane, y, rc, prim, result.depths[lane], working_data);
+        }
+
+        for (uint8_t i = 0; i < prim->vertex_count; i++) {
+            row.values[i] += prim->edges[i].b;
+        }
+    }
+
+    if (!rendered || !rc->pipeline->depth.write || !rc->depth_attachment) {
+        return false;
     }
 
-    if (sl->rc->semaphore) {
-        semaphore_signal(sl->rc->semaphore);
+    // blocks are never split between tiles, so this thread is the only one touching it
+    if (rc->depth_attachment->depth_hierarchy) {
+        depth_hierarchy_update_block(rc->depth_attachment->depth_hierarchy, rc->depth_attachment,
+                                     block_x, block_y);
     }
+
+    return true;
 }
 
-rasterizer_t* rasterizer_create(bool multithread) {
-    rasterizer_t* rast = mem_alloc(sizeof(rasterizer_t));
+// each bin is owned by exactly one job, so primitives touching the same pixel are always drawn in
+// submission order without any synchronization between threads
+static void render_tile(struct tile_bin* bin) {
+    const struct render_context* rc = bin->rc;
 
-    if (multithread) {
-        rast->worker = thread_worker_start(render_scanline, rast);
-        rast->num_scanlines = thread_worker_get_thread_count(rast->worker);
-    } else {
-        rast->worker = NULL;
-        rast->num_scanlines = 1;
+    // every fragment on this thread reuses the same working data
+    uint32_t thread_index = rc->worker ? thread_worker_get_thread_index(rc->worker) : 0;
+    void* working_data = NULL;
+
+    if (rc->scratch_stride > 0) {
+        working_data = rc->scratch + thread_index * rc->scratch_stride;
+    }
+
+    if (bin->clear_pending && rc->clear_values) {
+        const struct rect* rect = &bin->rect;
+
+        for (uint32_t i = 0; i < rc->fb->attachment_count; i++) {
+            image_fill_rect(rc->fb->attachments[i], rect->x, rect->y, rect->x + rect->width,
+                            rect->y + rect->height, &rc->clear_values[i]);
+        }
+
+        bin->clear_pending = false;
+    }
+
+    struct depth_hierarchy* hierarchy = NULL;
+    if (rc->depth_attachment) {
+        hierarchy = rc->depth_attachment->depth_hierarchy;
+    }
+
+    uint32_t tile_x = bin->rect.x / TILE_SIZE;
+    uint32_t tile_y = bin->rect.y / TILE_SIZE;
+    bool wrote_depth = false;
+
+    for (uint32_t i = 0; i < bin->primitive_count; i++) {
+        const struct primitive* prim = bin->primitives[i];
+
+        struct rect area;
+        if (!rect_intersect(&prim->scissor, &bin->rect, &area)) {
+            continue;
+        }
+
+        uint32_t x1 = area.x + area.width;
+        uint32_t y1 = area.y + area.height;
+
+        // earlier primitives in this tile may have covered it since binning
+        if (prim->rc->depth_hierarchy) {
+            float max_depth = hierarchy->tile_depths[tile_y * hierarchy->tiles_x + tile_x];
+            float min_depth = primitive_min_depth(prim, area.x, area.y, x1 - 1, y1 - 1);
+
+            if (depth_bound_rejects(min_depth, max_depth)) {
+                continue;
+            }
+        }
+
+        // blocks are aligned to the block grid and clipped to the area
+        for (uint32_t by = area.y - area.y % BLOCK_SIZE; by < y1; by += BLOCK_SIZE) {
+            uint32_t y0 = by > area.y ? by : area.y;
+            uint32_t height = (by + BLOCK_SIZE < y1 ? by + BLOCK_SIZE : y1) - y0;
+
+            for (uint32_t bx = area.x - area.x % BLOCK_SIZE; bx < x1; bx += BLOCK_SIZE) {
+                uint32_t x0 = bx > area.x ? bx : area.x;
+                uint32_t width = (bx + BLOCK_SIZE < x1 ? bx + BLOCK_SIZE : x1) - x0;
+
+                wrote_depth |= rasterize_block(prim->rc, prim, x0, y0, width, height, working_data);
+            }
+        }
+    }
+
+    if (wrote_depth && hierarchy) {
+        depth_hierarchy_update_tile(hierarchy, tile_x, tile_y);
     }
+}
+
+static void render_tile_range(void* user_data, uint32_t begin, uint32_t end) {
+    struct tile_bin** bins = user_data;
+
+    for (uint32_t i = begin; i < end; i++) {
+        render_tile(bins[i]);
+    }
+}
+
+static rasterizer_t* rasterizer_alloc(thread_worker_t* worker, bool shared_worker) {
+    mem_tag previous_tag = mem_set_thread_tag(MEM_TAG_RASTERIZER);
+    rasterizer_t* rast = mem_alloc(sizeof(rasterizer_t));
+
+    rast->worker = worker;
+    rast->shared_worker = shared_worker;
 
     rast->current_capture = NULL;
+
+    rast->tiles_x = rast->tiles_y = 0;
+    rast->bins = NULL;
+
+    rast->row_kernel = raster_select_row_kernel();
+
+    rast->scratch = NULL;
+    rast->scratch_size = 0;
+
+    rast->frame_arena = mem_arena_create(FRAME_ARENA_BLOCK_SIZE);
+
+    rast->pending_clear_fb = NULL;
+    rast->pending_clear_values = NULL;
+
+    rast->executor_running = rast->executor_busy = rast->executor_stopping = false;
+
+    pthread_mutex_init(&rast->queue_mutex, NULL);
+    pthread_cond_init(&rast->queue_signal, NULL);
+    pthread_cond_init(&rast->idle_signal, NULL);
+
+    list_init(&rast->queue);
+
+    mem_set_thread_tag(previous_tag);
     return rast;
 }
 
+rasterizer_t* rasterizer_create(bool multithread) {
+    if (!multithread) {
+        return rasterizer_alloc(NULL, false);
+    }
+
+    // every rasterizer submits to the same threads, so that several of them don't oversubscribe
+    // the machine
+    return rasterizer_alloc(thread_worker_acquire_shared(), true);
+}
+
+rasterizer_t* rasterizer_create_with_worker(thread_worker_t* worker) {
+    return rasterizer_alloc(worker, false);
+}
+
+static void rasterizer_free_bins(rasterizer_t* rast) {
+    uint32_t bin_count = rast->tiles_x * rast->tiles_y;
+    for (uint32_t i = 0; i < bin_count; i++) {
+        mem_free(rast->bins[i].primitives);
+    }
+
+    mem_free(rast->bins);
+    rast->bins = NULL;
+}
+
 void rasterizer_destroy(rasterizer_t* rast) {
     if (!rast) {
         return;
     }
 
-    thread_worker_stop(rast->worker);
+    // whatever was submitted still runs
+    if (rast->executor_running) {
+        pthread_mutex_lock(&rast->queue_mutex);
+        rast->executor_stopping = true;
+        pthread_cond_signal(&rast->queue_signal);
+        pthread_mutex_unlock(&rast->queue_mutex);
+
+        pthread_join(rast->executor, NULL);
+    }
+
+    pthread_mutex_destroy(&rast->queue_mutex);
+    pthread_cond_destroy(&rast->queue_signal);
+    pthread_cond_destroy(&rast->idle_signal);
+
+    if (rast->shared_worker) {
+        thread_worker_release_shared();
+    }
+
+    rasterizer_free_bins(rast);
+
+    mem_arena_destroy(rast->frame_arena);
+
+    mem_free(rast->scratch);
     mem_free(rast);
 }
 
+void rasterizer_begin_frame(rasterizer_t* rast) {
+    rasterizer_wait_idle(rast);
+
+    mem_tag previous_tag = mem_set_thread_tag(MEM_TAG_RASTERIZER);
+    mem_arena_reset(rast->frame_arena);
+    mem_set_thread_tag(previous_tag);
+}
+
 void rasterizer_set_current_capture(rasterizer_t* rast, capture_t* cap) {
     rast->current_capture = cap;
 }
 
+static size_t scratch_align(size_t size) {
+    return (size + SCRATCH_ALIGNMENT - 1) / SCRATCH_ALIGNMENT * SCRATCH_ALIGNMENT;
+}
+
+// makes sure that every thread has a slot of fragment working data for this call
+// returns the stride between slots
+static size_t rasterizer_prepare_scratch(rasterizer_t* rast, size_t slot_size) {
+    size_t stride = scratch_align(slot_size);
+
+    // the submitting thread gets the last slot. other threads outside of the worker never run our
+    // tiles, so it is never shared
+    uint32_t slots = rast->worker ? thread_worker_get_thread_count(rast->worker) + 1 : 1;
+    size_t size = stride * slots;
+
+    if (size > rast->scratch_size) {
+        mem_free(rast->scratch);
+
+        rast->scratch = mem_alloc(size);
+        rast->scratch_size = size;
+    }
+
+    return stride;
+}
+
+static void rasterizer_prepare_bins(rasterizer_t* rast, const struct framebuffer* fb) {
+    uint32_t tiles_x = (fb->width + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t tiles_y = (fb->height + TILE_SIZE - 1) / TILE_SIZE;
+
+    // bin storage is kept around between calls, we only reallocate when the grid changes
+    if (tiles_x != rast->tiles_x || tiles_y != rast->tiles_y) {
+        rasterizer_free_bins(rast);
+
+        rast->tiles_x = tiles_x;
+        rast->tiles_y = tiles_y;
+        rast->bins = mem_calloc(tiles_x * tiles_y, sizeof(struct tile_bin));
+    }
+
+    for (uint32_t y = 0; y < tiles_y; y++) {
+        for (uint32_t x = 0; x < tiles_x; x++) {
+            struct tile_bin* bin = &rast->bins[y * tiles_x + x];
+
+            bin->rect.x = x * TILE_SIZE;
+            bin->rect.y = y * TILE_SIZE;
+            bin->rect.width = TILE_SIZE;
+            bin->rect.height = TILE_SIZE;
+
+            bin->rc = NULL;
+            bin->primitive_count = 0;
+        }
+    }
+}
+
+static void bin_append(struct tile_bin* bin, const struct primitive* primitive) {
+    if (bin->primitive_count >= bin->capacity) {
+        bin->capacity = bin->capacity > 0 ? bin->capacity * 2 : 64;
+
+        size_t size = bin->capacity * sizeof(const struct primitive*);
+        bin->primitives = mem_realloc(bin->primitives, size);
+    }
+
+    bin->primitives[bin->primitive_count++] = primitive;
+}
+
+static void bin_primitive(rasterizer_t* rast, const struct primitive* prim) {
+    const struct rect* scissor = &prim->scissor;
+
+    uint32_t tx0 = scissor->x / TILE_SIZE;
+    uint32_t ty0 = scissor->y / TILE_SIZE;
+
+    uint32_t tx1 = (scissor->x + scissor->width - 1) / TILE_SIZE;
+    uint32_t ty1 = (scissor->y + scissor->height - 1) / TILE_SIZE;
+
+    if (tx1 >= rast->tiles_x) {
+        tx1 = rast->tiles_x - 1;
+    }
+
+    if (ty1 >= rast->tiles_y) {
+        ty1 = rast->tiles_y - 1;
+    }
+
+    const struct depth_hierarchy* hierarchy = prim->rc->depth_hierarchy;
+
+    for (uint32_t y = ty0; y <= ty1; y++) {
+        for (uint32_t x = tx0; x <= tx1; x++) {
+            // tiles that are already in front of the whole primitive don't need to see it
+            if (hierarchy) {
+                struct rect tile, area;
+                tile.x = x * TILE_SIZE;
+                tile.y = y * TILE_SIZE;
+                tile.width = tile.height = TILE_SIZE;
+
+                if (!rect_intersect(scissor, &tile, &area)) {
+                    continue;
+                }
+
+                float max_depth = hierarchy->tile_depths[y * hierarchy->tiles_x + x];
+                float min_depth = primitive_min_depth(prim, area.x, area.y,
+                                                      area.x + area.width - 1,
+                                                      area.y + area.height - 1);
+
+                if (depth_bound_rejects(min_depth, max_depth)) {
+                    continue;
+                }
+            }
+
+            bin_append(&rast->bins[y * rast->tiles_x + x], prim);
+        }
+    }
+}
+
+// shades the vertices of every draw of a batch in one go, however small each draw is
+static void process_vertices(rasterizer_t* rast, struct draw* draws, uint32_t draw_count) {
+    struct vertex_stage stage;
+    stage.draws = draws;
+    stage.draw_count = draw_count;
+    stage.offsets = mem_arena_alloc(rast->frame_arena, sizeof(uint32_t) * (draw_count + 1));
+
+    uint32_t total_vertices = 0;
+    for (uint32_t i = 0; i < draw_count; i++) {
+        stage.offsets[i] = total_vertices;
+        total_vertices += draws[i].cache.slot_count * draws[i].data->instance_count;
+    }
+
+    stage.offsets[draw_count] = total_vertices;
+    thread_worker_parallel_for(rast->worker, total_vertices, VERTEX_CHUNK_SIZE,
+                               process_vertex_range, &stage);
+}
+
+static void rasterize_bins(rasterizer_t* rast, const struct render_context* rc) {
+    uint32_t bin_count = rast->tiles_x * rast->tiles_y;
+    size_t bins_size = sizeof(struct tile_bin*) * bin_count;
+    struct tile_bin** bins = mem_arena_alloc(rast->frame_arena, bins_size);
+
+    uint32_t active_bins = 0;
+    for (uint32_t i = 0; i < bin_count; i++) {
+        struct tile_bin* bin = &rast->bins[i];
+        if (bin->primitive_count == 0) {
+            continue;
+        }
+
+        bin->rc = rc;
+        bins[active_bins++] = bin;
+    }
+
+    // one tile at a time, bins already vary a lot in cost
+    thread_worker_parallel_for(rast->worker, active_bins, 1, render_tile_range, bins);
+}
+
 static float map_dimension(float value, uint32_t size) {
     if (value < -1.f) {
         return 0;
@@ -493,17 +1363,16 @@ static float map_dimension(float value, uint32_t size) {
     return screen_space * size;
 }
 
-static bool gen_scissor_rect(const struct render_context* rc, struct rect* scissor,
-                             const struct rect* existing_scissor) {
+static bool gen_scissor_rect(const struct render_context* rc, const struct primitive* prim,
+                             struct rect* scissor, const struct rect* existing_scissor) {
     uint32_t x0 = UINT32_MAX;
     uint32_t y0 = UINT32_MAX;
 
     uint32_t x1 = 0;
     uint32_t y1 = 0;
 
-    for (uint8_t i = 0; i < rc->vertices; i++) {
-        const float* point = rc->outputs[i].position;
-
+    for (uint8_t i = 0; i < prim->vertex_count; i++) {
+        const float* point = prim->outputs[i].projected;
         float x = map_dimension(point[0], rc->fb->width);
         float y = map_dimension(point[1], rc->fb->height);
 
@@ -553,136 +1422,1178 @@ static bool gen_scissor_rect(const struct render_context* rc, struct rect* sciss
     return x1 > x0 && y1 > y0;
 }
 
-static void render_face(rasterizer_t* rast, const struct indexed_render_call* data, uint32_t face,
-                        struct render_context* rc, struct captured_primitive* captured) {
-    process_face_vertices(data, rc->instance_id, face, rc->vertices, rc->outputs, captured);
+// sums up the planes of vertex weights, each scaled by the value at that vertex
+static void plane_combine(const struct attribute_plane* weights, const float* values,
+                          uint8_t vertices, struct attribute_plane* result) {
+    result->origin = result->dx = result->dy = 0.f;
+
+    for (uint8_t i = 0; i < vertices; i++) {
+        result->origin += weights[i].origin * values[i];
+        result->dx += weights[i].dx * values[i];
+        result->dy += weights[i].dy * values[i];
+    }
+}
+
+// interpolated values are linear in screen space once divided by w, so everything the fragment
+// path needs can be set up once per primitive. shaders that interpolate linearly skip the divide
+static void setup_attribute_planes(const struct render_context* rc, struct primitive* prim) {
+    prim->origin_x = (int32_t)prim->scissor.x;
+    prim->origin_y = (int32_t)prim->scissor.y;
 
-    // todo: support geometry shaders?
+    // the weight of each vertex is its opposite edge function, normalized. that only holds for
+    // triangles, which is why quads never make it here
+    struct attribute_plane weights[MAX_PRIMITIVE_VERTICES];
+    float depths[MAX_PRIMITIVE_VERTICES];
+    float inverse_ws[MAX_PRIMITIVE_VERTICES];
 
-    struct rect scissor;
-    if (!gen_scissor_rect(rc, &scissor, data->scissor_rect)) {
-        return;
+    prim->min_depth = INFINITY;
+    for (uint8_t i = 0; i < prim->vertex_count; i++) {
+        const struct edge_function* edge = &prim->edges[i];
+        int64_t origin_value =
+            (int64_t)edge->a * prim->origin_x + (int64_t)edge->b * prim->origin_y + edge->c;
+
+        weights[i].origin = (float)origin_value * prim->inverse_area;
+        weights[i].dx = (float)edge->a * prim->inverse_area;
+        weights[i].dy = (float)edge->b * prim->inverse_area;
+
+        depths[i] = prim->outputs[i].projected[2];
+        inverse_ws[i] = prim->outputs[i].projected[3];
+
+        prim->min_depth = depths[i] < prim->min_depth ? depths[i] : prim->min_depth;
     }
 
-    if (captured) {
-        memcpy(&captured->scissor, &scissor, sizeof(struct rect));
+    // depth is affine over a rectangle, so its smallest value is at one of the corners
+    if (prim->rectangle) {
+        float corner_depth = prim->outputs[3].projected[2];
+        prim->min_depth = corner_depth < prim->min_depth ? corner_depth : prim->min_depth;
     }
 
-    uint32_t total_jobs =
-        scissor.height < rast->num_scanlines ? scissor.height : rast->num_scanlines;
+    plane_combine(weights, depths, prim->vertex_count, &prim->depth);
+    plane_combine(weights, inverse_ws, prim->vertex_count, &prim->inverse_w);
 
-    struct scanline scanlines[total_jobs];
-    for (uint32_t i = 0; i < total_jobs; i++) {
-        struct scanline* sl = &scanlines[i];
-        sl->index = i;
-        sl->scissor = &scissor;
-        sl->rc = rc;
+    const struct shader* shader = &rc->pipeline->shader;
+    struct attribute_plane* plane = prim->planes;
 
-        // if multithreading is supported, we want to take advantage of it
-        if (rast->worker) {
-            thread_worker_push_job(rast->worker, sl);
-        } else {
-            render_scanline(rast, sl);
+    float values[MAX_PRIMITIVE_VERTICES];
+    for (uint32_t i = 0; i < shader->inter_stage_parameter_count; i++) {
+        const struct blended_parameter* parameter = &shader->inter_stage_parameters[i];
+        size_t stride = parameter_element_stride(parameter->type);
+
+        for (uint32_t j = 0; j < parameter->count; j++) {
+            size_t offset = parameter->offset + j * stride;
+
+            for (uint8_t k = 0; k < prim->vertex_count; k++) {
+                const void* source_data = prim->outputs[k].working_data + offset;
+
+                float vertex_value;
+                switch (parameter->type) {
+                case ELEMENT_TYPE_BYTE:
+                    vertex_value = (float)*(uint8_t*)source_data;
+                    break;
+                case ELEMENT_TYPE_FLOAT:
+                    vertex_value = *(float*)source_data;
+                    break;
+                }
+
+                values[k] = shader->linear_interpolation ? vertex_value
+                                                         : vertex_value * inverse_ws[k];
+            }
+
+            plane_combine(weights, values, prim->vertex_count, plane++);
         }
     }
+}
 
-    // if we have a semaphore, its probably being signaled
-    if (rc->semaphore) {
-        semaphore_wait_for_value(rc->semaphore, total_jobs);
+static int32_t snap_coordinate(float value, uint32_t size) {
+    float pixels = (value + 1.f) / 2.f * (float)size;
+    float snapped = roundf(pixels * (float)SUBPIXEL_ONE);
+
+    // written so that nan ends up clamped too
+    if (!(snapped > (float)-MAX_SNAPPED_COORDINATE)) {
+        return -MAX_SNAPPED_COORDINATE;
     }
-}
 
-static uint8_t topology_get_vertex_count(topology_type topology) {
-    switch (topology) {
-    case TOPOLOGY_TYPE_TRIANGLES:
-        return 3;
-    case TOPOLOGY_TYPE_QUADS:
-        return 4;
-    default:
-        return 0;
+    if (!(snapped < (float)MAX_SNAPPED_COORDINATE)) {
+        return MAX_SNAPPED_COORDINATE;
     }
+
+    return (int32_t)snapped;
 }
 
-void render_indexed(rasterizer_t* rast, struct indexed_render_call* data) {
-    // todo: add support for strips! only lists are supported
-    uint8_t vertices_per_face = topology_get_vertex_count(data->pipeline->topology);
-    uint32_t face_count = data->index_count / vertices_per_face;
+// true if the bounding box of the snapped points contains at least one pixel center, including
+// centers on its edges
+static bool snapped_bounds_cover_center(const int32_t (*points)[2], uint8_t vertices) {
+    for (uint8_t axis = 0; axis < 2; axis++) {
+        int32_t min = points[0][axis];
+        int32_t max = points[0][axis];
 
-    // do we care if there are unused indices?
+        for (uint8_t i = 1; i < vertices; i++) {
+            min = points[i][axis] < min ? points[i][axis] : min;
+            max = points[i][axis] > max ? points[i][axis] : max;
+        }
 
-    struct vertex_output outputs[vertices_per_face];
-    void* working_data_block = mem_alloc(data->pipeline->shader.working_size * vertices_per_face);
+        // first and last pixel whose center is within [min, max]
+        int32_t half = SUBPIXEL_ONE / 2;
+        int32_t first = (min - half + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+        int32_t last = (max - half) >> SUBPIXEL_BITS;
 
-    for (uint8_t i = 0; i < vertices_per_face; i++) {
-        outputs[i].working_data = working_data_block + data->pipeline->shader.working_size * i;
+        if (first > last) {
+            return false;
+        }
     }
 
-    struct render_context rc;
-    rc.pipeline = data->pipeline;
-    rc.fb = data->framebuffer;
-    rc.outputs = outputs;
-    rc.vertices = vertices_per_face;
-    rc.uniform_data = data->uniform_data;
-
-    if (rast->worker) {
-        rc.semaphore = semaphore_create();
-    } else {
-        rc.semaphore = NULL;
+    return true;
+}
+
+// narrows the scissor of a rectangle down to the pixels it covers. the first triangle of a
+// rectangle spans all of it, so its points are enough. centers on the left and top edges are
+// inside, like they would be for the edges of either triangle
+static bool rectangle_clip_scissor(struct primitive* prim, const int32_t (*points)[2]) {
+    int32_t first[2], end[2];
+
+    for (uint8_t axis = 0; axis < 2; axis++) {
+        int32_t min = points[0][axis];
+        int32_t max = points[0][axis];
+
+        for (uint8_t i = 1; i < 3; i++) {
+            min = points[i][axis] < min ? points[i][axis] : min;
+            max = points[i][axis] > max ? points[i][axis] : max;
+        }
+
+        // pixels whose center is within [min, max)
+        int32_t half = SUBPIXEL_ONE / 2;
+        first[axis] = (min - half + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+        end[axis] = (max - half + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS;
+
+        first[axis] = first[axis] > 0 ? first[axis] : 0;
+        end[axis] = end[axis] > 0 ? end[axis] : 0;
     }
 
-    struct captured_render_call* captured = NULL;
-    if (rast->current_capture) {
-        captured = mem_alloc(sizeof(struct captured_render_call));
-        captured->first_instance = data->first_instance;
-        captured->instance_count = data->instance_count;
-        captured->vertices_per_primitive = vertices_per_face;
-        captured->primitive_count = face_count;
-        captured->vertex_buffer_count = data->pipeline->binding_count;
-        captured->working_data_stride = data->pipeline->shader.working_size;
+    struct rect covered;
+    covered.x = (uint32_t)first[0];
+    covered.y = (uint32_t)first[1];
+    covered.width = end[0] > first[0] ? (uint32_t)(end[0] - first[0]) : 0;
+    covered.height = end[1] > first[1] ? (uint32_t)(end[1] - first[1]) : 0;
 
-        captured->vertex_buffers =
-            mem_alloc(sizeof(struct captured_vertex_buffer) * captured->vertex_buffer_count);
+    struct rect scissor = prim->scissor;
+    return rect_intersect(&scissor, &covered, &prim->scissor);
+}
 
-        captured->instances = mem_alloc(sizeof(struct captured_instance) * data->instance_count);
+// computes edge function coefficients once, so that the raster loops only have to step them.
+// returns false for primitives that can't cover any pixel, or that are culled
+static bool setup_primitive(const struct render_context* rc, struct primitive* prim) {
+    uint8_t vertices = prim->vertex_count;
 
-        for (uint32_t i = 0; i < captured->vertex_buffer_count; i++) {
-            struct captured_vertex_buffer* captured_vbuf = &captured->vertex_buffers[i];
-            const struct vertex_binding* binding = &data->pipeline->bindings[i];
-            const struct vertex_buffer* vbuf = &data->vertices[i];
+    int32_t points[MAX_PRIMITIVE_VERTICES][2];
+    for (uint8_t i = 0; i < vertices; i++) {
+        const float* position = prim->outputs[i].projected;
 
-            captured_vbuf->instance_data = binding->input_rate == VERTEX_INPUT_RATE_INSTANCE;
-            captured_vbuf->vertex_stride = binding->stride;
+        points[i][0] = snap_coordinate(position[0], rc->fb->width);
+        points[i][1] = snap_coordinate(position[1], rc->fb->height);
+    }
 
-            captured_vbuf->size = vbuf->size;
-            captured_vbuf->data = mem_alloc(vbuf->size);
-            memcpy(captured_vbuf->data, vbuf->data, vbuf->size);
-        }
+    // slivers and specks that fall between pixel centers
+    if (!snapped_bounds_cover_center(points, vertices)) {
+        return false;
     }
 
-    for (uint32_t i = 0; i < data->instance_count; i++) {
-        rc.instance_id = data->first_instance + i;
+    if (prim->rectangle && !rectangle_clip_scissor(prim, points)) {
+        return false;
+    }
 
-        struct captured_instance* captured_instance = NULL;
-        if (captured) {
-            captured_instance = &captured->instances[i];
-            captured_instance->primitives =
-                mem_alloc(sizeof(struct captured_primitive) * face_count);
-        }
+    int64_t sign = rc->pipeline->winding == WINDING_ORDER_CW ? -1 : 1;
 
-        for (uint32_t j = 0; j < face_count; j++) {
-            struct captured_primitive* captured_primitive = NULL;
-            if (captured_instance) {
-                captured_primitive = &captured_instance->primitives[j];
-            }
+    // twice the signed area, in snapped units
+    int64_t orientation = 0;
+    for (uint8_t i = 0; i < vertices; i++) {
+        const int32_t* a = points[i];
+        const int32_t* b = points[(i + 1) % vertices];
 
-            render_face(rast, data, j, &rc, captured_primitive);
-        }
+        orientation += (int64_t)a[0] * b[1] - (int64_t)b[0] * a[1];
+    }
+
+    // degenerate, nothing can be inside of every edge
+    if (orientation == 0) {
+        return false;
     }
 
-    if (rast->current_capture && captured) {
-        capture_add_render_call(rast->current_capture, data->framebuffer, captured);
+    // back faces are rejected here once, instead of by every pixel test. if we're not culling,
+    // they are flipped around so that the inside is always positive
+    if (orientation * sign < 0) {
+        if (rc->pipeline->cull_back) {
+            return false;
+        }
+
+        sign *= -1;
+    }
+
+    int64_t area_sum = 0;
+    for (uint8_t i = 0; i < vertices; i++) {
+        const int32_t* a = points[i];
+        const int32_t* b = points[(i + 1) % vertices];
+
+        int64_t dx = (b[0] - a[0]) * sign;
+        int64_t dy = (b[1] - a[1]) * sign;
+
+        // the edge from i to i + 1 is opposite to vertex i + 2
+        struct edge_function* edge = &prim->edges[(i + 2) % vertices];
+        edge->a = (int32_t)-dy;
+        edge->b = (int32_t)dx;
+
+        // value at the center of pixel (0, 0)
+        int64_t half = SUBPIXEL_ONE / 2;
+        int64_t value = dx * (half - a[1]) - dy * (half - a[0]);
+
+        // top-left rule: pixel centers exactly on a top or left edge are inside
+        if (dy < 0 || (dy == 0 && dx > 0)) {
+            value++;
+        }
+
+        // from one pixel center to the next, the edge function changes by whole multiples of
+        // SUBPIXEL_ONE. so we can divide it out, rounding up so that "> 0" means the same thing
+        edge->c = -((-value) >> SUBPIXEL_BITS);
+
+        // the sum of all edge functions is constant over the plane
+        area_sum += edge->c;
+    }
+
+    if (area_sum == 0) {
+        return false;
+    }
+
+    prim->inverse_area = 1.f / (float)(area_sum > 0 ? area_sum : -area_sum);
+
+    setup_attribute_planes(rc, prim);
+    return true;
+}
+
+// positive on the inside of the plane
+static float clip_distance(const struct render_context* rc, clip_plane plane,
+                           const float* position) {
+    switch (plane) {
+    case CLIP_NEAR:
+        return position[2] + position[3];
+    case CLIP_GUARD_X_MIN:
+        return rc->guard_x * position[3] + position[0];
+    case CLIP_GUARD_X_MAX:
+        return rc->guard_x * position[3] - position[0];
+    case CLIP_GUARD_Y_MIN:
+        return rc->guard_y * position[3] + position[1];
+    case CLIP_GUARD_Y_MAX:
+        return rc->guard_y * position[3] - position[1];
+    default:
+        return 0.f;
+    }
+}
+
+// returns false if the face is entirely outside of the view volume. otherwise, planes is set to
+// the planes that the face has to be clipped against, if any
+static bool face_clip_planes(const struct vertex_output* outputs, uint8_t vertices,
+                             uint32_t* planes) {
+    uint32_t all_outside = UINT32_MAX;
+    uint32_t any_outside = 0;
+
+    for (uint8_t i = 0; i < vertices; i++) {
+        uint32_t code = outputs[i].clip_code;
+
+        all_outside &= code;
+        any_outside |= code;
+    }
+
+    if ((all_outside & CLIP_VIEW_VOLUME) != 0) {
+        return false;
+    }
+
+    *planes = any_outside & CLIP_PLANES;
+    return true;
+}
+
+// inter-stage parameters are linear in clip space, so they are interpolated along with the
+// position. anything else is taken from the vertex on the inside
+static void clip_interpolate(const struct render_context* rc, const struct vertex_output* inside,
+                             const struct vertex_output* outside, float t,
+                             struct vertex_output* result, mem_arena_t* arena) {
+    for (uint32_t i = 0; i < 4; i++) {
+        float a = inside->position[i];
+        result->position[i] = a + (outside->position[i] - a) * t;
+    }
+
+    project_vertex(rc, result);
+
+    const struct shader* shader = &rc->pipeline->shader;
+    if (shader->working_size == 0) {
+        result->working_data = NULL;
+        return;
+    }
+
+    result->working_data = mem_arena_alloc(arena, shader->working_size);
+    memcpy(result->working_data, inside->working_data, shader->working_size);
+
+    for (uint32_t i = 0; i < shader->inter_stage_parameter_count; i++) {
+        const struct blended_parameter* parameter = &shader->inter_stage_parameters[i];
+        size_t stride = parameter_element_stride(parameter->type);
+
+        for (uint32_t j = 0; j < parameter->count; j++) {
+            size_t offset = parameter->offset + j * stride;
+
+            const void* a = inside->working_data + offset;
+            const void* b = outside->working_data + offset;
+            void* destination = result->working_data + offset;
+
+            float a_value, b_value;
+            switch (parameter->type) {
+            case ELEMENT_TYPE_BYTE:
+                a_value = (float)*(uint8_t*)a;
+                b_value = (float)*(uint8_t*)b;
+                break;
+            case ELEMENT_TYPE_FLOAT:
+                a_value = *(float*)a;
+                b_value = *(float*)b;
+                break;
+            }
+
+            float value = a_value + (b_value - a_value) * t;
+            switch (parameter->type) {
+            case ELEMENT_TYPE_BYTE:
+                *(uint8_t*)destination = (uint8_t)(value + 0.5f);
+                break;
+            case ELEMENT_TYPE_FLOAT:
+                *(float*)destination = value;
+                break;
+            }
+        }
+    }
+}
+
+// sutherland-hodgman against a single plane. returns the new vertex count
+static uint8_t clip_polygon(const struct render_context* rc, clip_plane plane,
+                            const struct vertex_output* input, uint8_t input_count,
+                            struct vertex_output* output, mem_arena_t* arena) {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < input_count && count < MAX_CLIPPED_VERTICES; i++) {
+        const struct vertex_output* a = &input[i];
+        const struct vertex_output* b = &input[(i + 1) % input_count];
+
+        float distance_a = clip_distance(rc, plane, a->position);
+        float distance_b = clip_distance(rc, plane, b->position);
+
+        if (distance_a >= 0.f) {
+            output[count++] = *a;
+        }
+
+        // vertices exactly on the plane are kept as they are, so only edges that strictly cross
+        // it get a new vertex
+        bool crosses = (distance_a > 0.f && distance_b < 0.f) ||
+                       (distance_a < 0.f && distance_b > 0.f);
+
+        if (!crosses || count >= MAX_CLIPPED_VERTICES) {
+            continue;
+        }
+
+        // always interpolated from the inside, so that faces sharing the edge agree on the vertex
+        if (distance_a > 0.f) {
+            clip_interpolate(rc, a, b, distance_a / (distance_a - distance_b), &output[count++],
+                             arena);
+        } else {
+            clip_interpolate(rc, b, a, distance_b / (distance_b - distance_a), &output[count++],
+                             arena);
+        }
+    }
+
+    return count;
+}
+
+// clips a face to the given planes. returns the vertex count of the remaining convex polygon
+static uint8_t clip_face(const struct render_context* rc, uint32_t planes,
+                         const struct vertex_output* face, uint8_t vertices,
+                         struct vertex_output* result, mem_arena_t* arena) {
+    struct vertex_output buffers[2][MAX_CLIPPED_VERTICES];
+    memcpy(buffers[0], face, vertices * sizeof(struct vertex_output));
+
+    uint8_t current = 0;
+    uint8_t count = vertices;
+
+    while (planes != 0 && count >= 3) {
+        clip_plane plane = (clip_plane)(planes & -planes);
+        planes &= planes - 1;
+
+        count = clip_polygon(rc, plane, buffers[current], count, buffers[current ^ 1], arena);
+        current ^= 1;
+    }
+
+    memcpy(result, buffers[current], count * sizeof(struct vertex_output));
+    return count;
+}
+
+// clipping leaves every vertex in front of the camera, except for those of degenerate faces
+static bool primitive_in_front(const struct primitive* prim) {
+    for (uint8_t i = 0; i < prim->vertex_count; i++) {
+        if (!(prim->outputs[i].position[3] > 0.f)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// values are taken as affine if they agree to about this much, relative to their size
+#define RECTANGLE_VALUE_TOLERANCE 1e-5f
+
+static bool rectangle_value_affine(float corner, float diagonal_0, float diagonal_1,
+                                   float opposite) {
+    float expected = diagonal_0 + diagonal_1 - opposite;
+    float magnitude = fabsf(expected) > fabsf(corner) ? fabsf(expected) : fabsf(corner);
+
+    return fabsf(expected - corner) <= RECTANGLE_VALUE_TOLERANCE * (1.f + magnitude);
+}
+
+// true if triangles a and b share a diagonal, and together cover an axis-aligned rectangle over
+// which depth and every inter-stage value are affine. the rectangle can then be drawn as one
+// primitive, with the planes of a and no edge tests. returns the index of the corner of b that a
+// doesn't have
+static bool faces_form_rectangle(const struct render_context* rc, const struct vertex_output* a,
+                                 const struct vertex_output* b, uint8_t* corner) {
+    // vertices of the same instance share their working data, so it identifies them
+    uint8_t opposite = 3;
+    for (uint8_t i = 0; i < 3; i++) {
+        if (a[i].working_data != b[0].working_data && a[i].working_data != b[1].working_data &&
+            a[i].working_data != b[2].working_data) {
+            opposite = opposite == 3 ? i : 4;
+        }
+    }
+
+    // exactly one vertex that b doesn't have
+    if (opposite > 2) {
+        return false;
+    }
+
+    const struct vertex_output* o = &a[opposite];
+    const struct vertex_output* d0 = &a[(opposite + 1) % 3];
+    const struct vertex_output* d1 = &a[(opposite + 2) % 3];
+
+    // going around b, the diagonal has to come back from d1 to d0, or the two would face
+    // different ways
+    *corner = 3;
+    for (uint8_t i = 0; i < 3; i++) {
+        if (b[(i + 1) % 3].working_data == d1->working_data &&
+            b[(i + 2) % 3].working_data == d0->working_data) {
+            *corner = i;
+        }
+    }
+
+    if (*corner == 3) {
+        return false;
+    }
+
+    const struct vertex_output* c = &b[*corner];
+    const struct vertex_output* vertices[4] = { o, d0, d1, c };
+
+    int32_t points[4][2];
+    for (uint8_t i = 0; i < 4; i++) {
+        points[i][0] = snap_coordinate(vertices[i]->projected[0], rc->fb->width);
+        points[i][1] = snap_coordinate(vertices[i]->projected[1], rc->fb->height);
+    }
+
+    // o and c are opposite corners, and the diagonal goes through the other two
+    if (points[0][0] == points[3][0] || points[0][1] == points[3][1]) {
+        return false;
+    }
+
+    bool d0_shares_x = points[1][0] == points[0][0] && points[1][1] == points[3][1] &&
+                       points[2][0] == points[3][0] && points[2][1] == points[0][1];
+
+    bool d0_shares_y = points[1][0] == points[3][0] && points[1][1] == points[0][1] &&
+                       points[2][0] == points[0][0] && points[2][1] == points[3][1];
+
+    if (!d0_shares_x && !d0_shares_y) {
+        return false;
+    }
+
+    // with a varying w, values aren't affine in screen space even if they are per vertex
+    const struct shader* shader = &rc->pipeline->shader;
+    if (!shader->linear_interpolation) {
+        for (uint8_t i = 1; i < 4; i++) {
+            if (vertices[i]->projected[3] != o->projected[3]) {
+                return false;
+            }
+        }
+    }
+
+    if (!rectangle_value_affine(c->projected[2], d0->projected[2], d1->projected[2],
+                                o->projected[2])) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < shader->inter_stage_parameter_count; i++) {
+        const struct blended_parameter* parameter = &shader->inter_stage_parameters[i];
+        size_t stride = parameter_element_stride(parameter->type);
+
+        for (uint32_t j = 0; j < parameter->count; j++) {
+            size_t offset = parameter->offset + j * stride;
+
+            float values[4];
+            for (uint8_t k = 0; k < 4; k++) {
+                const void* source_data = vertices[k]->working_data + offset;
+
+                switch (parameter->type) {
+                case ELEMENT_TYPE_BYTE:
+                    values[k] = (float)*(uint8_t*)source_data;
+                    break;
+                case ELEMENT_TYPE_FLOAT:
+                    values[k] = *(float*)source_data;
+                    break;
+                }
+            }
+
+            if (!rectangle_value_affine(values[3], values[1], values[2], values[0])) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// sets up and bins the primitive at the given index. returns false if nothing of it can be drawn,
+// in which case the slot can be reused
+static bool emit_primitive(rasterizer_t* rast, const struct render_context* rc, uint32_t index,
+                           const struct rect* scissor_rect, struct rect* captured_scissor) {
+    struct primitive* prim = &rc->primitives[index];
+    prim->rc = rc;
+
+    if (!primitive_in_front(prim)) {
+        return false;
+    }
+
+    if (!gen_scissor_rect(rc, prim, &prim->scissor, scissor_rect)) {
+        return false;
+    }
+
+    if (captured_scissor) {
+        memcpy(captured_scissor, &prim->scissor, sizeof(struct rect));
+    }
+
+    if (!setup_primitive(rc, prim)) {
+        return false;
+    }
+
+    bin_primitive(rast, prim);
+    return true;
+}
+
+static uint8_t topology_get_vertex_count(topology_type topology) {
+    switch (topology) {
+    case TOPOLOGY_TYPE_TRIANGLES:
+    case TOPOLOGY_TYPE_TRIANGLE_STRIP:
+    case TOPOLOGY_TYPE_TRIANGLE_FAN:
+        return 3;
+    case TOPOLOGY_TYPE_QUADS:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+struct clear_job {
+    const struct framebuffer* fb;
+    const image_pixel* clear_values;
+
+    // pending bins, or NULL to clear rows
+    struct tile_bin** bins;
+};
+
+static void clear_row_range(void* user_data, uint32_t begin, uint32_t end) {
+    const struct clear_job* job = user_data;
+    uint32_t y0 = begin * CLEAR_CHUNK_ROWS;
+    uint32_t y1 = end * CLEAR_CHUNK_ROWS;
+
+    for (uint32_t i = 0; i < job->fb->attachment_count; i++) {
+        image_t* attachment = job->fb->attachments[i];
+        image_fill_rect(attachment, 0, y0, attachment->width, y1, &job->clear_values[i]);
+    }
+}
+
+static void clear_tile_range(void* user_data, uint32_t begin, uint32_t end) {
+    const struct clear_job* job = user_data;
+
+    for (uint32_t i = begin; i < end; i++) {
+        struct tile_bin* bin = job->bins[i];
+        const struct rect* rect = &bin->rect;
+
+        for (uint32_t j = 0; j < job->fb->attachment_count; j++) {
+            image_fill_rect(job->fb->attachments[j], rect->x, rect->y, rect->x + rect->width,
+                            rect->y + rect->height, &job->clear_values[j]);
+        }
+
+        bin->clear_pending = false;
+    }
+}
+
+// writes the pending clear to every tile that no call has touched yet
+static void rasterizer_flush_clear(rasterizer_t* rast) {
+    if (!rast->pending_clear_fb) {
+        return;
+    }
+
+    mem_arena_marker marker = mem_arena_get_marker(rast->frame_arena);
+
+    uint32_t bin_count = rast->tiles_x * rast->tiles_y;
+    struct clear_job job;
+    job.fb = rast->pending_clear_fb;
+    job.clear_values = rast->pending_clear_values;
+    job.bins = mem_arena_alloc(rast->frame_arena, sizeof(struct tile_bin*) * bin_count);
+
+    uint32_t pending_bins = 0;
+    for (uint32_t i = 0; i < bin_count; i++) {
+        if (rast->bins[i].clear_pending) {
+            job.bins[pending_bins++] = &rast->bins[i];
+        }
+    }
+
+    thread_worker_parallel_for(rast->worker, pending_bins, 1, clear_tile_range, &job);
+    mem_arena_rewind(rast->frame_arena, marker);
+
+    rast->pending_clear_fb = NULL;
+    rast->pending_clear_values = NULL;
+}
+
+static bool framebuffer_same_attachments(const struct framebuffer* a, const struct framebuffer* b) {
+    if (a->width != b->width || a->height != b->height) {
+        return false;
+    }
+
+    if (a->attachment_count != b->attachment_count) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < a->attachment_count; i++) {
+        if (a->attachments[i] != b->attachments[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// deferred clears are only recorded, see rasterizer_flush_clear. fb and clear_values have to stay
+// alive until then
+static void execute_clear(rasterizer_t* rast, const struct framebuffer* fb,
+                          const image_pixel* clear_values, capture_t* cap, bool deferred) {
+    rasterizer_flush_clear(rast);
+
+    // captures take a snapshot of the framebuffer after every command, which has to show the
+    // clear everywhere
+    if (cap) {
+        deferred = false;
+    }
+
+    for (uint32_t i = 0; i < fb->attachment_count; i++) {
+        image_t* attachment = fb->attachments[i];
+
+        // the hierarchy is tiny, so it is never deferred
+        if (attachment->format == IMAGE_FORMAT_DEPTH) {
+            depth_hierarchy_fill(attachment, clear_values[i].depth);
+        }
+    }
+
+    if (deferred) {
+        rasterizer_prepare_bins(rast, fb);
+
+        uint32_t bin_count = rast->tiles_x * rast->tiles_y;
+        for (uint32_t i = 0; i < bin_count; i++) {
+            rast->bins[i].clear_pending = true;
+        }
+
+        rast->pending_clear_fb = fb;
+        rast->pending_clear_values = clear_values;
+    } else {
+        uint32_t height = 0;
+        for (uint32_t i = 0; i < fb->attachment_count; i++) {
+            uint32_t attachment_height = fb->attachments[i]->height;
+            height = attachment_height > height ? attachment_height : height;
+        }
+
+        struct clear_job job;
+        job.fb = fb;
+        job.clear_values = clear_values;
+        job.bins = NULL;
+
+        uint32_t chunk_count = (height + CLEAR_CHUNK_ROWS - 1) / CLEAR_CHUNK_ROWS;
+        thread_worker_parallel_for(rast->worker, chunk_count, 1, clear_row_range, &job);
+    }
+
+    if (cap) {
+        capture_add_framebuffer_clear(cap, fb, clear_values);
+    }
+}
+
+static void draw_init(rasterizer_t* rast, struct draw* draw, const struct indexed_render_call* data,
+                      mem_arena_t* arena) {
+    uint8_t vertices_per_face = topology_get_vertex_count(data->pipeline->topology);
+    draw->data = data;
+
+    face_list_init(&draw->faces, data, vertices_per_face, arena);
+    uint32_t index_count = draw->faces.face_count * vertices_per_face;
+
+    // only the indices that faces actually use get shaded, once each no matter how many faces
+    // share them
+    vertex_cache_init(&draw->cache, data, draw->faces.indices, index_count, arena);
+
+    struct render_context* rc = &draw->rc;
+    rc->pipeline = data->pipeline;
+    rc->fb = data->framebuffer;
+    rc->primitives = NULL;
+    rc->primitive_count = 0;
+    rc->vertices = vertices_per_face;
+    rc->uniform_data = data->uniform_data;
+    rc->row_kernel = rast->row_kernel;
+
+    rc->guard_x = 1.f + 2.f * (float)GUARD_BAND_PIXELS / (float)data->framebuffer->width;
+    rc->guard_y = 1.f + 2.f * (float)GUARD_BAND_PIXELS / (float)data->framebuffer->height;
+
+    rc->depth_attachment = NULL;
+    for (uint32_t i = 0; i < data->framebuffer->attachment_count; i++) {
+        image_t* attachment = data->framebuffer->attachments[i];
+
+        if (attachment->format == IMAGE_FORMAT_DEPTH) {
+            rc->depth_attachment = attachment;
+            break;
+        }
+    }
+
+    // tiles still waiting for a clear get it from the first call that touches them, as long as
+    // it renders to the same images
+    rc->clear_values = NULL;
+    if (rast->pending_clear_fb) {
+        if (framebuffer_same_attachments(rast->pending_clear_fb, data->framebuffer)) {
+            rc->clear_values = rast->pending_clear_values;
+        } else {
+            rasterizer_flush_clear(rast);
+        }
+    }
+
+    rc->depth_hierarchy = NULL;
+    if (rc->depth_attachment && data->pipeline->depth.test) {
+        rc->depth_hierarchy = depth_hierarchy_get(rc->depth_attachment);
+    }
+}
+
+static struct captured_render_call* draw_capture(const struct draw* draw) {
+    const struct indexed_render_call* data = draw->data;
+
+    struct captured_render_call* captured =
+        mem_alloc_tagged(sizeof(struct captured_render_call), MEM_TAG_CAPTURE);
+
+    captured->first_instance = data->first_instance;
+    captured->instance_count = data->instance_count;
+    captured->vertices_per_primitive = draw->rc.vertices;
+    captured->primitive_count = draw->faces.face_count;
+    captured->vertex_buffer_count = data->pipeline->binding_count;
+    captured->working_data_stride = data->pipeline->shader.working_size;
+
+    size_t vertex_buffers_size =
+        sizeof(struct captured_vertex_buffer) * captured->vertex_buffer_count;
+
+    captured->vertex_buffers = mem_alloc_tagged(vertex_buffers_size, MEM_TAG_CAPTURE);
+
+    size_t instances_size = sizeof(struct captured_instance) * data->instance_count;
+    captured->instances = mem_alloc_tagged(instances_size, MEM_TAG_CAPTURE);
+
+    for (uint32_t i = 0; i < captured->vertex_buffer_count; i++) {
+        struct captured_vertex_buffer* captured_vbuf = &captured->vertex_buffers[i];
+        const struct vertex_binding* binding = &data->pipeline->bindings[i];
+        const struct vertex_buffer* vbuf = &data->vertices[i];
+
+        captured_vbuf->instance_data = binding->input_rate == VERTEX_INPUT_RATE_INSTANCE;
+        captured_vbuf->vertex_stride = binding->stride;
+
+        captured_vbuf->size = vbuf->size;
+        captured_vbuf->data = mem_alloc_tagged(vbuf->size, MEM_TAG_CAPTURE);
+        memcpy(captured_vbuf->data, vbuf->data, vbuf->size);
+    }
+
+    return captured;
+}
+
+// assembles, clips, sets up and bins every face of a draw whose vertices have been processed
+static void draw_bin(rasterizer_t* rast, struct draw* draw, struct captured_render_call* captured,
+                     mem_arena_t* arena) {
+    const struct indexed_render_call* data = draw->data;
+    const struct face_list* faces = &draw->faces;
+    const struct vertex_cache* cache = &draw->cache;
+    struct render_context* rc = &draw->rc;
+
+    uint8_t vertices_per_face = rc->vertices;
+    uint32_t face_count = faces->face_count;
+
+    // quads are split in two, and faces that need clipping can turn into a fan of several
+    // primitives
+    uint32_t clipped_faces = 0;
+    for (uint32_t i = 0; i < data->instance_count; i++) {
+        for (uint32_t j = 0; j < face_count; j++) {
+            struct vertex_output outputs[MAX_PRIMITIVE_VERTICES];
+            assemble_face(data, cache, faces, i, j, outputs, NULL);
+
+            uint32_t clip_planes;
+            if (face_clip_planes(outputs, vertices_per_face, &clip_planes) &&
+                clip_planes != 0) {
+                clipped_faces++;
+            }
+        }
+    }
+
+    uint32_t max_primitives = face_count * data->instance_count * (vertices_per_face - 2) +
+                              clipped_faces * (MAX_CLIPPED_PRIMITIVES - 1);
+
+    struct primitive* primitives =
+        mem_arena_alloc(arena, sizeof(struct primitive) * max_primitives);
+
+    uint32_t plane_count = shader_count_components(&data->pipeline->shader);
+    struct attribute_plane* planes =
+        mem_arena_alloc(arena, sizeof(struct attribute_plane) * plane_count * max_primitives);
+
+    rc->primitives = primitives;
+
+    uint32_t primitive_count = 0;
+    for (uint32_t i = 0; i < data->instance_count; i++) {
+        uint32_t instance_id = data->first_instance + i;
+
+        struct captured_instance* captured_instance = NULL;
+        if (captured) {
+            captured_instance = &captured->instances[i];
+            size_t primitives_size = sizeof(struct captured_primitive) * face_count;
+            captured_instance->primitives = mem_alloc_tagged(primitives_size, MEM_TAG_CAPTURE);
+        }
+
+        for (uint32_t j = 0; j < face_count; j++) {
+            struct captured_primitive* captured_primitive = NULL;
+            if (captured_instance) {
+                captured_primitive = &captured_instance->primitives[j];
+            }
+
+            struct vertex_output face[MAX_PRIMITIVE_VERTICES];
+            assemble_face(data, cache, faces, i, j, face, captured_primitive);
+
+            // todo: support geometry shaders?
+
+            uint32_t clip_planes;
+            if (!face_clip_planes(face, vertices_per_face, &clip_planes)) {
+                continue;
+            }
+
+            struct rect* captured_scissor = NULL;
+            if (captured_primitive) {
+                captured_scissor = &captured_primitive->scissor;
+            }
+
+            // most triangles are within the guard band, and go through as they are
+            if (clip_planes == 0 && vertices_per_face == 3) {
+                struct primitive* prim = &primitives[primitive_count];
+                prim->instance_id = instance_id;
+                prim->planes = &planes[primitive_count * plane_count];
+                prim->vertex_count = vertices_per_face;
+                prim->rectangle = false;
+                memcpy(prim->outputs, face, vertices_per_face * sizeof(struct vertex_output));
+
+                // pairs of triangles making up a rectangle, like text and most of any 2d ui, are
+                // drawn in one go without edge tests. captures keep every face to themselves
+                bool pair = j + 1 < face_count && !captured_instance;
+                if (pair) {
+                    struct vertex_output next[MAX_PRIMITIVE_VERTICES];
+                    assemble_face(data, cache, faces, i, j + 1, next, NULL);
+
+                    uint32_t next_planes;
+                    uint8_t corner;
+
+                    if (face_clip_planes(next, vertices_per_face, &next_planes) &&
+                        next_planes == 0 && faces_form_rectangle(rc, face, next, &corner)) {
+                        prim->rectangle = true;
+                        prim->outputs[3] = next[corner];
+                        j++;
+                    }
+                }
+
+                if (emit_primitive(rast, rc, primitive_count, data->scissor_rect,
+                                   captured_scissor)) {
+                    primitive_count++;
+                }
+
+                continue;
+            }
+
+            // everything else is drawn as a fan of triangles, since attribute planes can only
+            // interpolate between three vertices
+            struct vertex_output polygon[MAX_CLIPPED_VERTICES];
+            uint8_t polygon_vertices = vertices_per_face;
+
+            if (clip_planes == 0) {
+                memcpy(polygon, face, vertices_per_face * sizeof(struct vertex_output));
+            } else {
+                polygon_vertices =
+                    clip_face(rc, clip_planes, face, vertices_per_face, polygon, arena);
+            }
+
+            for (uint8_t k = 1; k + 1 < polygon_vertices; k++) {
+                struct primitive* prim = &primitives[primitive_count];
+                prim->instance_id = instance_id;
+                prim->planes = &planes[primitive_count * plane_count];
+                prim->vertex_count = 3;
+                prim->rectangle = false;
+                prim->outputs[0] = polygon[0];
+                prim->outputs[1] = polygon[k];
+                prim->outputs[2] = polygon[k + 1];
+
+                // the capture only has room for the scissor of one of them
+                if (emit_primitive(rast, rc, primitive_count, data->scissor_rect,
+                                   k == 1 ? captured_scissor : NULL)) {
+                    primitive_count++;
+                }
+            }
+        }
+    }
+
+    rc->primitive_count = primitive_count;
+}
+
+// every call has to render to the same images. the whole batch goes through the vertex stage and
+// gets binned before any pixel is touched, and tiles then draw the primitives of every call in
+// submission order
+static void execute_render_batch(rasterizer_t* rast, const struct indexed_render_call* calls,
+                                 uint32_t call_count, capture_t* cap) {
+    if (call_count == 0) {
+        return;
+    }
+
+    mem_tag previous_tag = mem_set_thread_tag(MEM_TAG_RASTERIZER);
+
+    // everything below is gone by the time we return
+    mem_arena_t* arena = rast->frame_arena;
+    mem_arena_marker marker = mem_arena_get_marker(arena);
+
+    struct draw* draws = mem_arena_alloc(arena, sizeof(struct draw) * call_count);
+    size_t working_size = 0;
+    bool derivatives = false;
+
+    for (uint32_t i = 0; i < call_count; i++) {
+        draw_init(rast, &draws[i], &calls[i], arena);
+
+        const struct shader* shader = &calls[i].pipeline->shader;
+        working_size = shader->working_size > working_size ? shader->working_size : working_size;
+        derivatives |= shader->derivatives;
+    }
+
+    // shaders that take derivatives also need room for the working data of their quad
+    size_t working_stride = scratch_align(working_size);
+    size_t slot_size = derivatives ? working_stride * 4 : working_size;
+
+    size_t scratch_stride = rasterizer_prepare_scratch(rast, slot_size);
+    for (uint32_t i = 0; i < call_count; i++) {
+        draws[i].rc.worker = rast->worker;
+        draws[i].rc.scratch = rast->scratch;
+        draws[i].rc.scratch_stride = scratch_stride;
+        draws[i].rc.working_stride = working_stride;
+    }
+
+    process_vertices(rast, draws, call_count);
+    rasterizer_prepare_bins(rast, calls[0].framebuffer);
+
+    struct captured_render_call** captured = NULL;
+    if (cap) {
+        captured = mem_arena_alloc(arena, sizeof(struct captured_render_call*) * call_count);
+    }
+
+    for (uint32_t i = 0; i < call_count; i++) {
+        if (captured) {
+            captured[i] = draw_capture(&draws[i]);
+        }
+
+        draw_bin(rast, &draws[i], captured ? captured[i] : NULL, arena);
+    }
+
+    rasterize_bins(rast, &draws[0].rc);
+
+    if (captured) {
+        for (uint32_t i = 0; i < call_count; i++) {
+            capture_add_render_call(cap, calls[i].framebuffer, captured[i]);
+        }
+    }
+
+    mem_arena_rewind(arena, marker);
+    mem_set_thread_tag(previous_tag);
+}
+
+// splits calls into runs that render to the same images. captures snapshot the framebuffer after
+// every call, so nothing is batched while capturing
+static void execute_render_indexed_batch(rasterizer_t* rast,
+                                         const struct indexed_render_call* calls,
+                                         uint32_t call_count, capture_t* cap) {
+    uint32_t first = 0;
+    while (first < call_count) {
+        uint32_t count = 1;
+
+        while (!cap && first + count < call_count) {
+            const struct indexed_render_call* last = &calls[first + count - 1];
+            const struct indexed_render_call* next = &calls[first + count];
+
+            if (!framebuffer_same_attachments(calls[first].framebuffer, next->framebuffer)) {
+                break;
+            }
+
+            // primitives are rejected against the depth hierarchy as of binning, which is only
+            // conservative as long as depth never moves back
+            const struct pipeline* pipeline = last->pipeline;
+            if (pipeline->depth.write && !pipeline->depth.test) {
+                break;
+            }
+
+            count++;
+        }
+
+        execute_render_batch(rast, &calls[first], count, cap);
+        first += count;
+    }
+}
+
+void framebuffer_clear(rasterizer_t* rast, struct framebuffer* fb,
+                       const image_pixel* clear_values) {
+    // submitted work may be using the same attachments
+    rasterizer_wait_idle(rast);
+    execute_clear(rast, fb, clear_values, rast->current_capture, false);
+}
+
+void render_indexed(rasterizer_t* rast, struct indexed_render_call* data) {
+    rasterizer_wait_idle(rast);
+    execute_render_batch(rast, data, 1, rast->current_capture);
+}
+
+void render_indexed_batch(rasterizer_t* rast, const struct indexed_render_call* calls,
+                          uint32_t call_count) {
+    rasterizer_wait_idle(rast);
+    execute_render_indexed_batch(rast, calls, call_count, rast->current_capture);
+}
+
+void array_render_call_to_indexed(const struct array_render_call* call,
+                                  struct indexed_render_call* result) {
+    memset(result, 0, sizeof(struct indexed_render_call));
+    result->vertices = call->vertices;
+    result->indices = NULL;
+
+    // indices count from 0, so the first vertex is the offset
+    result->vertex_offset = call->first_vertex;
+    result->first_index = 0;
+    result->index_count = call->vertex_count;
+
+    result->first_instance = call->first_instance;
+    result->instance_count = call->instance_count;
+
+    result->pipeline = call->pipeline;
+    result->framebuffer = call->framebuffer;
+    result->scissor_rect = call->scissor_rect;
+    result->uniform_data = call->uniform_data;
+}
+
+void render_arrays(rasterizer_t* rast, struct array_render_call* data) {
+    struct indexed_render_call call;
+    array_render_call_to_indexed(data, &call);
+
+    render_indexed(rast, &call);
+}
+
+static void rasterizer_execute(rasterizer_t* rast, const struct submission* submission) {
+    const command_buffer_t* cmd = submission->cmd;
+
+    for (uint32_t i = 0; i < cmd->command_count; i++) {
+        const struct command* command = &cmd->commands[i];
+
+        switch (command->type) {
+        case COMMAND_TYPE_CLEAR:
+            execute_clear(rast, command->clear.fb, command->clear.clear_values,
+                          submission->capture, true);
+            break;
+        case COMMAND_TYPE_RENDER_INDEXED:
+            execute_render_batch(rast, &command->render_indexed, 1, submission->capture);
+            break;
+        case COMMAND_TYPE_RENDER_INDEXED_BATCH:
+            execute_render_indexed_batch(rast, command->render_indexed_batch.calls,
+                                         command->render_indexed_batch.call_count,
+                                         submission->capture);
+            break;
+        }
+    }
+
+    // nothing is allowed to be pending once the fence is signaled
+    rasterizer_flush_clear(rast);
+}
+
+static void* rasterizer_executor_routine(void* arg) {
+    rasterizer_t* rast = arg;
+    pthread_mutex_lock(&rast->queue_mutex);
+
+    while (true) {
+        while (!rast->queue.head && !rast->executor_stopping) {
+            pthread_cond_wait(&rast->queue_signal, &rast->queue_mutex);
+        }
+
+        // only stop once everything submitted is done
+        struct list_node* node = rast->queue.head;
+        if (!node) {
+            break;
+        }
+
+        struct submission* submission = node->data;
+        list_remove(&rast->queue, node);
+
+        rast->executor_busy = true;
+        pthread_mutex_unlock(&rast->queue_mutex);
+
+        rasterizer_execute(rast, submission);
+
+        if (submission->fence) {
+            fence_signal(submission->fence);
+        }
+
+        mem_free(submission);
+
+        pthread_mutex_lock(&rast->queue_mutex);
+        rast->executor_busy = false;
+
+        if (!rast->queue.head) {
+            pthread_cond_broadcast(&rast->idle_signal);
+        }
+    }
+
+    pthread_mutex_unlock(&rast->queue_mutex);
+    return NULL;
+}
+
+void rasterizer_submit(rasterizer_t* rast, const command_buffer_t* cmd, fence_t* fence) {
+    mem_tag previous_tag = mem_set_thread_tag(MEM_TAG_RASTERIZER);
+
+    struct submission* submission = mem_alloc(sizeof(struct submission));
+    submission->cmd = cmd;
+    submission->fence = fence;
+    submission->capture = rast->current_capture;
+
+    pthread_mutex_lock(&rast->queue_mutex);
+
+    if (!rast->executor_running) {
+        pthread_create(&rast->executor, NULL, rasterizer_executor_routine, rast);
+        rast->executor_running = true;
+    }
+
+    list_append(&rast->queue, submission);
+    pthread_cond_signal(&rast->queue_signal);
+
+    pthread_mutex_unlock(&rast->queue_mutex);
+    mem_set_thread_tag(previous_tag);
+}
+
+void rasterizer_wait_idle(rasterizer_t* rast) {
+    pthread_mutex_lock(&rast->queue_mutex);
+
+    while (rast->queue.head || rast->executor_busy) {
+        pthread_cond_wait(&rast->idle_signal, &rast->queue_mutex);
     }
 
-    semaphore_destroy(rc.semaphore);
-    mem_free(working_data_block);
+    pthread_mutex_unlock(&rast->queue_mutex);
 }
@@ -15,6 +15,12 @@ typedef union image_pixel image_pixel;
 // from capture.h
 typedef struct capture capture_t;
 
+// from command_buffer.h
+typedef struct command_buffer command_buffer_t;
+
+// from fence.h
+typedef struct fence fence_t;
+
 struct framebuffer {
     image_t* const* attachments;
     uint32_t attachment_count;
@@ -42,12 +48,23 @@ struct shader_context {
 
     void* working_data;
     void* uniform_data;
+
+    // fragment stage only, for shaders that take derivatives: inter-stage values at the top left
+    // pixel of the 2x2 quad this fragment is in, then at its neighbors to the right and below. laid
+    // out like working_data
+    const void* quad_working_data[3];
 };
 
+// screen space derivatives of count floats at offset into the working data, across the quad of the
+// fragment. for picking mip levels with texture_sample_grad
+void shader_get_derivatives(const struct shader_context* context, size_t offset, uint32_t count,
+                            float* ddx, float* ddy);
+
 struct shader {
     size_t working_size;
 
-    // position: 4 float vector, defaults to <0, 0, 0, 1>
+    // position: 4 float clip space vector, defaults to <0, 0, 0, 1>. divided by w after clipping,
+    // with the visible depth range mapped from [-w, w] to [0, 1]
     void (*vertex_stage)(const void* const* vertex_data, const struct shader_context* context,
                          float* position);
 
@@ -55,6 +72,13 @@ struct shader {
 
     const struct blended_parameter* inter_stage_parameters;
     uint32_t inter_stage_parameter_count;
+
+    // interpolate inter-stage parameters linearly in screen space instead of perspective correct.
+    // cheaper, and the same for anything drawn with a constant w, like 2d overlays
+    bool linear_interpolation;
+
+    // fill in quad_working_data for the fragment stage
+    bool derivatives;
 };
 
 typedef enum {
@@ -75,6 +99,8 @@ typedef enum {
 typedef enum {
     TOPOLOGY_TYPE_TRIANGLES,
     TOPOLOGY_TYPE_QUADS,
+    TOPOLOGY_TYPE_TRIANGLE_STRIP,
+    TOPOLOGY_TYPE_TRIANGLE_FAN,
 } topology_type;
 
 typedef enum {
@@ -114,6 +140,9 @@ struct pipeline {
     winding_order winding;
     topology_type topology;
 
+    // indexed strips and fans end at an index with every bit set, and start over after it
+    bool primitive_restart;
+
     uint32_t blend_attachment_count;
     const struct blend_attachment* blend_attachments;
 };
@@ -123,9 +152,17 @@ struct vertex_buffer {
     size_t size;
 };
 
+typedef enum {
+    INDEX_TYPE_U16,
+    INDEX_TYPE_U32,
+} index_type;
+
 struct indexed_render_call {
     const struct vertex_buffer* vertices;
-    const uint16_t* indices;
+
+    // uint16_t or uint32_t, depending on index_type
+    const void* indices;
+    index_type index_type;
 
     uint32_t vertex_offset;
     uint32_t first_index, index_count;
@@ -139,15 +176,57 @@ struct indexed_render_call {
     void* uniform_data;
 };
 
+// draws vertex_count vertices in order, starting at first_vertex, without an index buffer
+struct array_render_call {
+    const struct vertex_buffer* vertices;
+
+    uint32_t first_vertex, vertex_count;
+    uint32_t first_instance, instance_count;
+
+    const struct pipeline* pipeline;
+    struct framebuffer* framebuffer;
+
+    const struct rect* scissor_rect;
+
+    void* uniform_data;
+};
+
+// from thread_worker.h
+typedef struct thread_worker thread_worker_t;
+
 typedef struct rasterizer rasterizer_t;
 
+// multithreaded rasterizers submit to the shared worker, see thread_worker_acquire_shared
 rasterizer_t* rasterizer_create(bool multithread);
+
+// submits to a worker owned by the caller, which has to outlive the rasterizer. NULL renders on
+// the calling thread
+rasterizer_t* rasterizer_create_with_worker(thread_worker_t* worker);
+
 void rasterizer_destroy(rasterizer_t* rast);
 
+// releases transient memory from the previous frame. call before any rendering in a frame
+void rasterizer_begin_frame(rasterizer_t* rast);
+
 void rasterizer_set_current_capture(rasterizer_t* rast, capture_t* cap);
 
+// these wait for submitted work to finish first, then draw before returning
 void framebuffer_clear(rasterizer_t* rast, struct framebuffer* fb, const image_pixel* clear_values);
-
 void render_indexed(rasterizer_t* rast, struct indexed_render_call* data);
+void render_arrays(rasterizer_t* rast, struct array_render_call* data);
+
+// draws calls in order, as if by render_indexed one after another. consecutive calls that render to
+// the same images share one pass through the vertex stage and the bins, which is a lot cheaper for
+// many small draws
+void render_indexed_batch(rasterizer_t* rast, const struct indexed_render_call* calls,
+                          uint32_t call_count);
+
+// runs every command of cmd in order on another thread, after anything submitted before it. the
+// current capture at the time of submission records it. cmd must not be changed until fence, which
+// may be NULL, is signaled
+void rasterizer_submit(rasterizer_t* rast, const command_buffer_t* cmd, fence_t* fence);
+
+// blocks until every submitted command buffer has run
+void rasterizer_wait_idle(rasterizer_t* rast);
 
 #endif
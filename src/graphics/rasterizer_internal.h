@@ -0,0 +1,193 @@
+#ifndef RASTERIZER_INTERNAL_H_
+#define RASTERIZER_INTERNAL_H_
+
+#include "graphics/rasterizer.h"
+#include "math/geo.h"
+
+// from mem.h
+typedef struct mem_arena mem_arena_t;
+
+// quads are the biggest faces we support. primitives are triangles, which use the last slot for
+// the corner of a rectangle
+#define MAX_PRIMITIVE_VERTICES 4
+
+// coverage is first decided for BLOCK_SIZE x BLOCK_SIZE pixel blocks
+#define BLOCK_SIZE 8
+
+struct vertex_output {
+    void* working_data;
+
+    // clip space, as written by the vertex stage
+    float position[4];
+
+    // ndc x and y, window depth and 1 / w. only meaningful if w > 0
+    float projected[4];
+
+    // which clip planes the position is outside of
+    uint32_t clip_code;
+};
+
+// vertex positions are snapped to 1 / SUBPIXEL_ONE of a pixel
+#define SUBPIXEL_BITS 8
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+
+// 16.8 fixed point. keeps edge coefficients within 25 bits, so that stepping them across a block
+// fits in 32 bits
+#define MAX_SNAPPED_COORDINATE (((1 << 15) - 1) * SUBPIXEL_ONE)
+
+// e(x, y) = a * x + b * y + c, where x and y are integer pixel coordinates and e is evaluated at
+// the pixel center. a pixel is inside of the edge if e > 0, with the top-left rule already applied
+struct edge_function {
+    int32_t a, b;
+    int64_t c;
+};
+
+// a value that is linear in screen space, relative to the plane origin of its primitive:
+// value(x, y) = origin + dx * (x - origin_x) + dy * (y - origin_y), at pixel centers
+struct attribute_plane {
+    float origin, dx, dy;
+};
+
+struct primitive {
+    // always a triangle. quads are split in two before setup, because the weights below are only
+    // barycentric for three vertices
+    struct vertex_output outputs[MAX_PRIMITIVE_VERTICES];
+    uint8_t vertex_count;
+    uint32_t instance_id;
+
+    // an axis-aligned rectangle made of two triangles. the first one is in outputs, followed by the
+    // corner that only the second one has, and the scissor is exactly the pixels they cover
+    bool rectangle;
+
+    // of the call that the primitive belongs to
+    const struct render_context* rc;
+
+    struct rect scissor;
+
+    // edges[i] is the edge opposite to vertex i, so that its value over the total area is the
+    // barycentric weight of that vertex
+    struct edge_function edges[MAX_PRIMITIVE_VERTICES];
+    float inverse_area;
+
+    // pixel that planes are relative to. kept close to the primitive, for precision
+    int32_t origin_x, origin_y;
+
+    // window depth, which is linear in screen space after the perspective divide
+    struct attribute_plane depth;
+
+    // 1 / w
+    struct attribute_plane inverse_w;
+
+    // smallest depth of any vertex
+    float min_depth;
+
+    // value / w of every inter-stage component, in declaration order. perspective correct values
+    // are then one multiply away
+    struct attribute_plane* planes;
+};
+
+// a horizontal run of at most BLOCK_SIZE pixels of one primitive
+struct raster_row {
+    const struct primitive* prim;
+    uint8_t vertices;
+
+    uint32_t x, y, width;
+
+    // edge function values at (x, y)
+    int64_t values[MAX_PRIMITIVE_VERTICES];
+
+    // mask of the edges that need to be tested per pixel. 0 if the whole row is inside
+    uint32_t coverage_edges;
+
+    // reject negative depths
+    bool test_depth;
+
+    // depth buffer values starting at (x, y), or NULL to skip the depth test
+    const float* depth_values;
+};
+
+// outputs of a row kernel, indexed by lane
+struct raster_row_result {
+    float depths[BLOCK_SIZE];
+};
+
+// evaluates coverage and depth for a whole row at once. returns a mask of the lanes that
+// passed every test
+typedef uint32_t (*raster_row_kernel)(const struct raster_row* row,
+                                      struct raster_row_result* result);
+
+// picks the widest kernel the cpu supports
+raster_row_kernel raster_select_row_kernel();
+
+struct render_context {
+    const struct pipeline* pipeline;
+    struct framebuffer* fb;
+
+    struct primitive* primitives;
+    uint32_t primitive_count;
+
+    // per face, before clipping
+    uint8_t vertices;
+
+    void* uniform_data;
+
+    // extent of the guard band in ndc, from the center of the framebuffer
+    float guard_x, guard_y;
+
+    // first depth attachment of the framebuffer, if any
+    image_t* depth_attachment;
+
+    // of the depth attachment, only used for rejection if the pipeline tests depth
+    struct depth_hierarchy* depth_hierarchy;
+
+    // written to tiles with a pending clear before anything else, if not NULL
+    const image_pixel* clear_values;
+    raster_row_kernel row_kernel;
+
+    // fragment working data, one slot of scratch_stride bytes per thread that can run tiles
+    thread_worker_t* worker;
+    void* scratch;
+    size_t scratch_stride;
+
+    // within a slot, between the working data of a fragment and each of its quad
+    size_t working_stride;
+};
+
+// the same call, with indices set to NULL. indexed calls without indices use index i for the ith
+// vertex of the call
+void array_render_call_to_indexed(const struct array_render_call* call,
+                                  struct indexed_render_call* result);
+
+typedef enum {
+    COMMAND_TYPE_CLEAR,
+    COMMAND_TYPE_RENDER_INDEXED,
+    COMMAND_TYPE_RENDER_INDEXED_BATCH,
+} command_type;
+
+// pointers in commands are either into the arena of their command buffer or owned by the caller
+struct command {
+    command_type type;
+
+    union {
+        struct {
+            struct framebuffer* fb;
+            const image_pixel* clear_values;
+        } clear;
+
+        struct indexed_render_call render_indexed;
+
+        struct {
+            struct indexed_render_call* calls;
+            uint32_t call_count;
+        } render_indexed_batch;
+    };
+};
+
+struct command_buffer {
+    struct command* commands;
+    uint32_t command_count, capacity;
+
+    mem_arena_t* arena;
+};
+
+#endif
@@ -1,13 +1,14 @@
 #include "texture.h"
 
+#include "core/mem.h"
 #include "core/util.h"
 #include "graphics/image.h"
 
 #include <string.h>
 #include <math.h>
 
-uint32_t texture_get_channels(const struct texture* texture) {
-    switch (texture->image->format) {
+static uint32_t image_get_channels(const image_t* image) {
+    switch (image->format) {
     case IMAGE_FORMAT_COLOR:
         return 4;
     case IMAGE_FORMAT_DEPTH:
@@ -17,6 +18,10 @@ uint32_t texture_get_channels(const struct texture* texture) {
     }
 }
 
+uint32_t texture_get_channels(const struct texture* texture) {
+    return image_get_channels(texture->image);
+}
+
 static void texture_get_pixel(const image_t* image, uint32_t x, uint32_t y, float* data) {
     uint32_t index = image_get_pixel_index(image, x, y);
     size_t pixel_offset = index * image->pixel_stride;
@@ -34,9 +39,9 @@ static void texture_get_pixel(const image_t* image, uint32_t x, uint32_t y, floa
     }
 }
 
-static void texture_sample_linear(const struct texture* texture, const float* uv, float* sample) {
-    float x_f = uv[0] * (texture->image->width - 1);
-    float y_f = uv[1] * (texture->image->height - 1);
+static void texture_sample_linear(const image_t* image, const float* uv, float* sample) {
+    float x_f = uv[0] * (image->width - 1);
+    float y_f = uv[1] * (image->height - 1);
 
     uint32_t x0 = (uint32_t)floor(x_f);
     uint32_t y0 = (uint32_t)floor(y_f);
@@ -44,7 +49,7 @@ static void texture_sample_linear(const struct texture* texture, const float* uv
     uint32_t x1 = (uint32_t)ceil(x_f);
     uint32_t y1 = (uint32_t)ceil(y_f);
 
-    uint32_t channels = texture_get_channels(texture);
+    uint32_t channels = image_get_channels(image);
     memset(sample, 0, channels * sizeof(float));
 
     for (uint32_t i = 0; i < 4; i++) {
@@ -56,7 +61,7 @@ static void texture_sample_linear(const struct texture* texture, const float* uv
         float weight = (1.f - fabsf(delta_x)) * (1.f - fabsf(delta_y));
 
         float current_sample[channels];
-        texture_get_pixel(texture->image, x, y, current_sample);
+        texture_get_pixel(image, x, y, current_sample);
 
         for (uint32_t j = 0; j < channels; j++) {
             sample[j] += current_sample[j] * weight;
@@ -64,14 +69,14 @@ static void texture_sample_linear(const struct texture* texture, const float* uv
     }
 }
 
-static void texture_sample_nearest(const struct texture* texture, const float* uv, float* sample) {
-    float x_f = uv[0] * (texture->image->width - 1);
-    float y_f = uv[1] * (texture->image->height - 1);
+static void texture_sample_nearest(const image_t* image, const float* uv, float* sample) {
+    float x_f = uv[0] * (image->width - 1);
+    float y_f = uv[1] * (image->height - 1);
 
     uint32_t x = (uint32_t)round(x_f);
     uint32_t y = (uint32_t)round(y_f);
 
-    texture_get_pixel(texture->image, x, y, sample);
+    texture_get_pixel(image, x, y, sample);
 }
 
 static float texture_repeat_coordinate(float value) {
@@ -94,12 +99,10 @@ static float texture_clamp_coordinate_to_edge(float value) {
     return value;
 }
 
-void texture_sample(const struct texture* texture, const float* uv, float* sample) {
-    float corrected_uv[2];
-
+static void texture_wrap_uv(const struct sampler* sampler, const float* uv, float* result) {
     for (uint32_t i = 0; i < 2; i++) {
         float value = uv[i];
-        switch (texture->sampler->wrapping) {
+        switch (sampler->wrapping) {
         case SAMPLER_WRAPPING_REPEAT:
             value = texture_repeat_coordinate(value);
             break;
@@ -108,15 +111,161 @@ void texture_sample(const struct texture* texture, const float* uv, float* sampl
             break;
         }
 
-        corrected_uv[i] = value;
+        result[i] = value;
     }
+}
 
-    switch (texture->sampler->filter) {
+// uv has to be wrapped already
+static void texture_sample_image(const struct sampler* sampler, const image_t* image,
+                                 const float* uv, float* sample) {
+    switch (sampler->filter) {
     case SAMPLER_FILTER_LINEAR:
-        texture_sample_linear(texture, corrected_uv, sample);
+        texture_sample_linear(image, uv, sample);
         break;
     case SAMPLER_FILTER_NEAREST:
-        texture_sample_nearest(texture, corrected_uv, sample);
+        texture_sample_nearest(image, uv, sample);
         break;
     }
 }
+
+void texture_sample(const struct texture* texture, const float* uv, float* sample) {
+    float corrected_uv[2];
+    texture_wrap_uv(texture->sampler, uv, corrected_uv);
+
+    texture_sample_image(texture->sampler, texture->image, corrected_uv, sample);
+}
+
+// level 0 is the image itself
+static const image_t* texture_get_level(const image_t* image, uint32_t level) {
+    return level > 0 ? image->mips[level - 1] : image;
+}
+
+void texture_sample_grad(const struct texture* texture, const float* uv, const float* ddx,
+                         const float* ddy, float* sample) {
+    const image_t* image = texture->image;
+    const struct sampler* sampler = texture->sampler;
+
+    if (!sampler->mipmapped || image->mip_count == 0) {
+        texture_sample(texture, uv, sample);
+        return;
+    }
+
+    // texels that one pixel step covers, along whichever screen axis covers more
+    float dx_u = ddx[0] * (float)image->width;
+    float dx_v = ddx[1] * (float)image->height;
+    float dy_u = ddy[0] * (float)image->width;
+    float dy_v = ddy[1] * (float)image->height;
+
+    float footprint_x = dx_u * dx_u + dx_v * dx_v;
+    float footprint_y = dy_u * dy_u + dy_v * dy_v;
+    float footprint = footprint_x > footprint_y ? footprint_x : footprint_y;
+
+    // log2 of the square root. magnified, flat and nan footprints all end up at the base level
+    float lod = 0.5f * log2f(footprint);
+    float max_lod = (float)image->mip_count;
+
+    lod = lod > 0.f ? lod : 0.f;
+    lod = lod < max_lod ? lod : max_lod;
+
+    float corrected_uv[2];
+    texture_wrap_uv(sampler, uv, corrected_uv);
+
+    if (sampler->mip_filter == SAMPLER_FILTER_NEAREST) {
+        uint32_t level = (uint32_t)(lod + 0.5f);
+        texture_sample_image(sampler, texture_get_level(image, level), corrected_uv, sample);
+
+        return;
+    }
+
+    uint32_t level = (uint32_t)lod;
+    float weight = lod - (float)level;
+
+    texture_sample_image(sampler, texture_get_level(image, level), corrected_uv, sample);
+    if (weight <= 0.f) {
+        return;
+    }
+
+    uint32_t channels = image_get_channels(image);
+    float next_sample[channels];
+    texture_sample_image(sampler, texture_get_level(image, level + 1), corrected_uv, next_sample);
+
+    for (uint32_t i = 0; i < channels; i++) {
+        sample[i] += (next_sample[i] - sample[i]) * weight;
+    }
+}
+
+// averages four packed pixels per byte, two bytes at a time. the sums of each byte fit in 10 bits,
+// so they never carry into their neighbors
+static uint32_t average_pixels(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    const uint32_t mask = 0x00FF00FF;
+    const uint32_t rounding = 0x00020002;
+
+    uint32_t low = (a & mask) + (b & mask) + (c & mask) + (d & mask);
+    uint32_t high = ((a >> 8) & mask) + ((b >> 8) & mask) + ((c >> 8) & mask) + ((d >> 8) & mask);
+
+    low = ((low + rounding) >> 2) & mask;
+    high = ((high + rounding) >> 2) & mask;
+
+    return low | (high << 8);
+}
+
+static void texture_downsample(const image_t* source, image_t* destination) {
+    const uint32_t* src = source->data;
+    uint32_t* dst = destination->data;
+
+    for (uint32_t y = 0; y < destination->height; y++) {
+        // odd sizes repeat their last row or column
+        uint32_t y0 = y * 2;
+        uint32_t y1 = y0 + 1 < source->height ? y0 + 1 : y0;
+
+        const uint32_t* row0 = src + image_get_pixel_index(source, 0, y0);
+        const uint32_t* row1 = src + image_get_pixel_index(source, 0, y1);
+
+        for (uint32_t x = 0; x < destination->width; x++) {
+            uint32_t x0 = x * 2;
+            uint32_t x1 = x0 + 1 < source->width ? x0 + 1 : x0;
+
+            uint32_t index = image_get_pixel_index(destination, x, y);
+            dst[index] = average_pixels(row0[x0], row0[x1], row1[x0], row1[x1]);
+        }
+    }
+}
+
+void texture_generate_mips(image_t* image) {
+    if (image->format != IMAGE_FORMAT_COLOR) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < image->mip_count; i++) {
+        image_free(image->mips[i]);
+    }
+
+    mem_free(image->mips);
+    image->mips = NULL;
+    image->mip_count = 0;
+
+    uint32_t count = 0;
+    for (uint32_t width = image->width, height = image->height; width > 1 || height > 1; count++) {
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    image->mips = mem_alloc(sizeof(image_t*) * count);
+    image->mip_count = count;
+
+    const image_t* source = image;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t width = source->width > 1 ? source->width / 2 : 1;
+        uint32_t height = source->height > 1 ? source->height / 2 : 1;
+
+        image_t* level = image_allocate(width, height, IMAGE_FORMAT_COLOR);
+        texture_downsample(source, level);
+
+        image->mips[i] = level;
+        source = level;
+    }
+}
@@ -2,6 +2,7 @@
 #define TEXTURE_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef enum {
     SAMPLER_FILTER_NEAREST,
@@ -16,6 +17,11 @@ typedef enum {
 struct sampler {
     sampler_filter filter;
     sampler_wrapping wrapping;
+
+    // only used by texture_sample_grad, on images with mips. nearest picks the closest level,
+    // linear blends between the two closest ones
+    bool mipmapped;
+    sampler_filter mip_filter;
 };
 
 // from image.h
@@ -33,4 +39,13 @@ uint32_t texture_get_channels(const struct texture* texture);
 // texture_get_channels)
 void texture_sample(const struct texture* texture, const float* uv, float* sample);
 
+// same as texture_sample, but picks a mip level from how much uv changes from one pixel to the
+// next. ddx and ddy are those changes, see shader_get_derivatives
+void texture_sample_grad(const struct texture* texture, const float* uv, const float* ddx,
+                         const float* ddy, float* sample);
+
+// (re)builds the mip chain of a color image with a box filter, down to 1x1. has to be called again
+// after the image changes
+void texture_generate_mips(image_t* image);
+
 #endif
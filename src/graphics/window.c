@@ -28,13 +28,23 @@ struct window {
     ImGuiContext* imgui;
 };
 
+static void* sdl_mem_alloc(size_t size) { return mem_alloc_tagged(size, MEM_TAG_SDL); }
+
+static void* sdl_mem_calloc(size_t nmemb, size_t size) {
+    return mem_calloc_tagged(nmemb, size, MEM_TAG_SDL);
+}
+
+static void* sdl_mem_realloc(void* mem, size_t size) {
+    return mem_realloc_tagged(mem, size, MEM_TAG_SDL);
+}
+
 static bool video_add_ref() {
     if (s_video_data) {
         s_video_data->references++;
         return true;
     }
 
-    SDL_SetMemoryFunctions(mem_alloc, mem_calloc, mem_realloc, mem_free);
+    SDL_SetMemoryFunctions(sdl_mem_alloc, sdl_mem_calloc, sdl_mem_realloc, mem_free);
 
     if (!SDL_InitSubSystem(SDL_INIT_VIDEO)) {
         return false;
@@ -1,14 +1,20 @@
 #include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "core/fence.h"
+#include "core/mem.h"
+#include "core/util.h"
 #include "math/vec.h"
 #include "math/mat.h"
+#include "graphics/command_buffer.h"
 #include "graphics/rasterizer.h"
 #include "graphics/window.h"
 #include "graphics/imgui.h"
 #include "graphics/image.h"
+#include "graphics/texture.h"
 #include "debug/diag.h"
 
 struct uniforms {
@@ -29,6 +35,35 @@ struct shader_working_data {
     uint32_t color;
 };
 
+// checkerboard under the triangles, fine enough that the far side of it needs mips
+#define FLOOR_EXTENT 4.f
+#define FLOOR_HEIGHT -0.25f
+
+#define FLOOR_TEXTURE_SIZE 512
+#define FLOOR_CHECKER_SIZE 8
+
+struct floor_uniforms {
+    struct uniforms camera;
+    struct texture texture;
+};
+
+struct floor_vertex {
+    float position[3];
+    float uv[2];
+};
+
+struct floor_working_data {
+    float uv[2];
+};
+
+// a strip of two triangles
+static const struct floor_vertex s_floor_vertices[] = {
+    { { -FLOOR_EXTENT, FLOOR_HEIGHT, -FLOOR_EXTENT }, { 0.f, 0.f } },
+    { { FLOOR_EXTENT, FLOOR_HEIGHT, -FLOOR_EXTENT }, { 1.f, 0.f } },
+    { { -FLOOR_EXTENT, FLOOR_HEIGHT, FLOOR_EXTENT }, { 0.f, 1.f } },
+    { { FLOOR_EXTENT, FLOOR_HEIGHT, FLOOR_EXTENT }, { 1.f, 1.f } },
+};
+
 static const struct vertex s_vertices[] = {
     { 0.f, -0.5f, 0.f },
     { 0.5f, 0.5f, 0.f },
@@ -64,6 +99,52 @@ static uint32_t fragment_shader(const struct shader_context* context) {
     return data->color;
 }
 
+static void floor_vertex_shader(const void* const* vertex_data,
+                                const struct shader_context* context, float* position) {
+    const struct floor_vertex* vertex = vertex_data[0];
+    const struct floor_uniforms* uniforms = context->uniform_data;
+
+    float world_position[4];
+    memcpy(world_position, vertex->position, 3 * sizeof(float));
+    world_position[3] = 1.f;
+
+    float view_position[4];
+    mat_dot(uniforms->camera.view, world_position, 4, 4, 1, view_position);
+    mat_dot(uniforms->camera.projection, view_position, 4, 4, 1, position);
+
+    struct floor_working_data* result = context->working_data;
+    memcpy(result->uv, vertex->uv, 2 * sizeof(float));
+}
+
+static uint32_t floor_fragment_shader(const struct shader_context* context) {
+    const struct floor_working_data* data = context->working_data;
+    const struct floor_uniforms* uniforms = context->uniform_data;
+
+    // the floor is mostly seen at an angle, so the mip level has to follow how fast uv changes
+    float ddx[2], ddy[2];
+    shader_get_derivatives(context, offsetof(struct floor_working_data, uv), 2, ddx, ddy);
+
+    float color[4];
+    texture_sample_grad(&uniforms->texture, data->uv, ddx, ddy, color);
+
+    return util_float4_to_u32(color);
+}
+
+static image_t* create_floor_texture() {
+    image_t* image = image_allocate(FLOOR_TEXTURE_SIZE, FLOOR_TEXTURE_SIZE, IMAGE_FORMAT_COLOR);
+    uint32_t* pixels = image->data;
+
+    for (uint32_t y = 0; y < image->height; y++) {
+        for (uint32_t x = 0; x < image->width; x++) {
+            bool light = (x / FLOOR_CHECKER_SIZE + y / FLOOR_CHECKER_SIZE) % 2 == 0;
+            pixels[image_get_pixel_index(image, x, y)] = light ? 0xC8C8C8FF : 0x383838FF;
+        }
+    }
+
+    texture_generate_mips(image);
+    return image;
+}
+
 static void time_diff(const struct timespec* t0, const struct timespec* t1,
                       struct timespec* delta) {
     delta->tv_sec = t1->tv_sec - t0->tv_sec;
@@ -131,6 +212,44 @@ int main(int argc, const char** argv) {
     pipeline.winding = WINDING_ORDER_CCW;
     pipeline.topology = TOPOLOGY_TYPE_TRIANGLES;
 
+    struct vertex_binding floor_binding;
+    floor_binding.stride = sizeof(struct floor_vertex);
+    floor_binding.input_rate = VERTEX_INPUT_RATE_VERTEX;
+
+    struct blended_parameter uv_parameter;
+    uv_parameter.count = 2;
+    uv_parameter.type = ELEMENT_TYPE_FLOAT;
+    uv_parameter.offset = offsetof(struct floor_working_data, uv);
+
+    struct pipeline floor_pipeline;
+    memset(&floor_pipeline, 0, sizeof(struct pipeline));
+
+    floor_pipeline.shader.working_size = sizeof(struct floor_working_data);
+    floor_pipeline.shader.vertex_stage = floor_vertex_shader;
+    floor_pipeline.shader.fragment_stage = floor_fragment_shader;
+    floor_pipeline.shader.inter_stage_parameter_count = 1;
+    floor_pipeline.shader.inter_stage_parameters = &uv_parameter;
+    floor_pipeline.shader.derivatives = true;
+    floor_pipeline.depth.test = true;
+    floor_pipeline.depth.write = true;
+    floor_pipeline.binding_count = 1;
+    floor_pipeline.bindings = &floor_binding;
+    floor_pipeline.cull_back = false;
+    floor_pipeline.topology = TOPOLOGY_TYPE_TRIANGLE_STRIP;
+
+    struct sampler floor_sampler;
+    memset(&floor_sampler, 0, sizeof(struct sampler));
+    floor_sampler.filter = SAMPLER_FILTER_LINEAR;
+    floor_sampler.wrapping = SAMPLER_WRAPPING_CLAMP_TO_EDGE;
+    floor_sampler.mipmapped = true;
+    floor_sampler.mip_filter = SAMPLER_FILTER_LINEAR;
+
+    image_t* floor_image = create_floor_texture();
+
+    struct floor_uniforms floor_uniforms;
+    floor_uniforms.texture.image = floor_image;
+    floor_uniforms.texture.sampler = &floor_sampler;
+
     image_t* attachments[2];
     memset(attachments, 0, sizeof(attachments));
 
@@ -216,8 +335,20 @@ int main(int argc, const char** argv) {
     call.framebuffer = &fb;
     call.scissor_rect = NULL;
 
+    struct vertex_buffer floor_vbuf;
+    floor_vbuf.data = s_floor_vertices;
+    floor_vbuf.size = sizeof(s_floor_vertices);
+
+    struct array_render_call floor_call;
+    memset(&floor_call, 0, sizeof(struct array_render_call));
+
+    floor_call.vertices = &floor_vbuf;
+    floor_call.vertex_count = 4;
+    floor_call.instance_count = 1;
+    floor_call.pipeline = &floor_pipeline;
+    floor_call.framebuffer = &fb;
+
     struct uniforms uniforms;
-    call.uniform_data = &uniforms;
 
     struct timespec t0, t1, delta;
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t0);
@@ -240,21 +371,32 @@ int main(int argc, const char** argv) {
 
     igCreateContext(NULL);
     window_init_imgui(window);
-    imgui_init_renderer(rast);
+    imgui_init_renderer();
 
     ImGuiIO* io = igGetIO_Nil();
     io->ConfigFlags |= ImGuiConfigFlags_DockingEnable;
 
-    // diagnostics ui is kinda not helpful rn
-    // todo: work on it some more
-    // diag_init();
+    // frame captures and the memory panel
+    diag_init();
+
+    // frames are recorded here and rendered on the rasterizer's own thread, so that building one
+    // frame overlaps with rendering the previous one
+    command_buffer_t* cmd = command_buffer_create();
+    fence_t* frame_fence = fence_create(true);
+
+    bool frame_pending = false;
+    bool frame_captured = false;
 
     while (!window_is_close_requested(window)) {
         window_poll();
         igNewFrame();
 
+        // diag_update picks up the capture of the last frame, so it has to be done recording
+        if (frame_captured) {
+            fence_wait(frame_fence);
+        }
+
         diag_update();
-        rasterizer_set_current_capture(rast, diag_current_capture());
 
         static bool draw_demo = true;
         if (draw_demo) {
@@ -268,6 +410,23 @@ int main(int argc, const char** argv) {
         float delta_seconds = (float)delta.tv_sec + (float)delta.tv_nsec / 1e+9f;
         total_seconds += delta_seconds;
 
+        igRender();
+
+        // everything from here on touches what the previous frame is rendering with
+        fence_wait(frame_fence);
+
+        if (frame_pending && !window_swap_buffers(window)) {
+            success = false;
+            break;
+        }
+
+        frame_pending = false;
+        rasterizer_begin_frame(rast);
+
+        capture_t* capture = diag_current_capture();
+        rasterizer_set_current_capture(rast, capture);
+        frame_captured = capture != NULL;
+
         image_t* backbuffer = window_get_backbuffer(window);
         if (!backbuffer) {
             success = false;
@@ -298,22 +457,36 @@ int main(int argc, const char** argv) {
         mat_perspective(uniforms.projection, vfov, aspect, 0.1f, 100.f);
         mat_look_at(uniforms.view, camera_position, center, up);
 
-        framebuffer_clear(rast, &fb, clear);
-        render_indexed(rast, &call);
+        command_buffer_reset(cmd);
+        command_buffer_clear(cmd, &fb, clear);
 
-        igRender();
-        imgui_render(igGetDrawData(), &fb);
+        call.uniform_data = command_buffer_copy(cmd, &uniforms, sizeof(struct uniforms));
+        command_buffer_render_indexed(cmd, &call);
 
-        if (!window_swap_buffers(window)) {
-            success = false;
-            break;
-        }
+        memcpy(&floor_uniforms.camera, &uniforms, sizeof(struct uniforms));
+        floor_call.uniform_data =
+            command_buffer_copy(cmd, &floor_uniforms, sizeof(struct floor_uniforms));
+
+        command_buffer_render_arrays(cmd, &floor_call);
+
+        imgui_render(igGetDrawData(), &fb, cmd);
+
+        fence_reset(frame_fence);
+        rasterizer_submit(rast, cmd, frame_fence);
+        frame_pending = true;
 
         rasterizer_set_current_capture(rast, NULL);
+        mem_end_frame();
     }
 
+    rasterizer_wait_idle(rast);
+
+    fence_destroy(frame_fence);
+    command_buffer_destroy(cmd);
+
     // free depth buffer
     image_free(attachments[1]);
+    image_free(floor_image);
 
     diag_shutdown();
 
@@ -95,7 +95,7 @@ void mat_perspective(float* mat, float vfov, float aspect, float near, float far
     mat[5] = 1.f / tan_half_vfov;
 
     // mat[2, 2]
-    mat[10] = -(far + near) / (near - far);
+    mat[10] = -(far + near) / (far - near);
 
     // mat[2, 3]
     mat[11] = -(2.f * far * near) / (far - near);
@@ -0,0 +1,195 @@
+#include "core/fence.h"
+#include "core/mem.h"
+#include "debug/capture.h"
+#include "graphics/command_buffer.h"
+#include "graphics/image.h"
+#include "graphics/rasterizer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// checks that captures of a command buffer, whose clears are deferred until a call touches each
+// tile, see the same framebuffer as captures of the same commands run one by one
+
+#define WIDTH 256
+#define HEIGHT 192
+
+// whatever the previous frame left behind
+#define STALE_COLOR 0xDEADBEEF
+
+struct vertex {
+    float position[2];
+};
+
+// a small triangle in one corner, so that most tiles are never touched by a call
+static const struct vertex s_vertices[] = {
+    { { -0.9f, -0.9f } },
+    { { -0.6f, -0.9f } },
+    { { -0.9f, -0.6f } },
+};
+
+static void vertex_shader(const void* const* vertex_data, const struct shader_context* context,
+                          float* position) {
+    const struct vertex* vertex = vertex_data[0];
+    (void)context;
+
+    position[0] = vertex->position[0];
+    position[1] = vertex->position[1];
+}
+
+static uint32_t fragment_shader(const struct shader_context* context) {
+    (void)context;
+    return 0xFF0000FF;
+}
+
+struct scene {
+    image_t* attachments[2];
+    struct framebuffer fb;
+
+    struct vertex_binding binding;
+    struct pipeline pipeline;
+
+    struct vertex_buffer vbuf;
+    struct array_render_call call;
+
+    image_pixel clear[2];
+};
+
+static void scene_init(struct scene* scene) {
+    scene->attachments[0] = image_allocate(WIDTH, HEIGHT, IMAGE_FORMAT_COLOR);
+    scene->attachments[1] = image_allocate(WIDTH, HEIGHT, IMAGE_FORMAT_DEPTH);
+
+    scene->fb.attachments = scene->attachments;
+    scene->fb.attachment_count = 2;
+    scene->fb.width = WIDTH;
+    scene->fb.height = HEIGHT;
+
+    scene->binding.stride = sizeof(struct vertex);
+    scene->binding.input_rate = VERTEX_INPUT_RATE_VERTEX;
+
+    memset(&scene->pipeline, 0, sizeof(struct pipeline));
+    scene->pipeline.shader.vertex_stage = vertex_shader;
+    scene->pipeline.shader.fragment_stage = fragment_shader;
+    scene->pipeline.depth.test = true;
+    scene->pipeline.depth.write = true;
+    scene->pipeline.binding_count = 1;
+    scene->pipeline.bindings = &scene->binding;
+    scene->pipeline.topology = TOPOLOGY_TYPE_TRIANGLES;
+
+    scene->vbuf.data = s_vertices;
+    scene->vbuf.size = sizeof(s_vertices);
+
+    memset(&scene->call, 0, sizeof(struct array_render_call));
+    scene->call.vertices = &scene->vbuf;
+    scene->call.vertex_count = 3;
+    scene->call.instance_count = 1;
+    scene->call.pipeline = &scene->pipeline;
+    scene->call.framebuffer = &scene->fb;
+
+    scene->clear[0].color = 0x787878FF;
+    scene->clear[1].depth = 1.f;
+}
+
+static void scene_make_stale(struct scene* scene) {
+    image_pixel stale[2];
+    stale[0].color = STALE_COLOR;
+    stale[1].depth = 0.f;
+
+    for (uint32_t i = 0; i < 2; i++) {
+        image_t* attachment = scene->attachments[i];
+        image_pixel* pixels = attachment->data;
+
+        for (uint32_t j = 0; j < attachment->width * attachment->height; j++) {
+            pixels[j] = stale[i];
+        }
+
+        // the rasterizer rebuilds it from the new contents
+        mem_free(attachment->depth_hierarchy);
+        attachment->depth_hierarchy = NULL;
+    }
+}
+
+static void scene_free(struct scene* scene) {
+    for (uint32_t i = 0; i < 2; i++) {
+        image_free(scene->attachments[i]);
+    }
+}
+
+// counts pixels that differ between the results of two captures
+static uint32_t compare_captures(const capture_t* a, const capture_t* b) {
+    const struct capture_event* events_a[2];
+    const struct capture_event* events_b[2];
+
+    if (capture_get_events(a, NULL) != 2 || capture_get_events(b, NULL) != 2) {
+        printf("expected a clear and a render call in each capture\n");
+        return 1;
+    }
+
+    capture_get_events(a, events_a);
+    capture_get_events(b, events_b);
+
+    uint32_t differences = 0;
+    for (uint32_t i = 0; i < 2; i++) {
+        const image_t* result_a = events_a[i]->results[0];
+        const image_t* result_b = events_b[i]->results[0];
+
+        const uint32_t* pixels_a = result_a->data;
+        const uint32_t* pixels_b = result_b->data;
+
+        uint32_t event_differences = 0;
+        for (uint32_t j = 0; j < WIDTH * HEIGHT; j++) {
+            if (pixels_a[j] != pixels_b[j] || pixels_a[j] == STALE_COLOR) {
+                event_differences++;
+            }
+        }
+
+        printf("event %u: %u pixels differ\n", i, event_differences);
+        differences += event_differences;
+    }
+
+    return differences;
+}
+
+int main() {
+    rasterizer_t* rast = rasterizer_create(true);
+
+    struct scene scene;
+    scene_init(&scene);
+
+    // one by one, nothing is deferred
+    capture_t* immediate = capture_new();
+    scene_make_stale(&scene);
+
+    rasterizer_begin_frame(rast);
+    rasterizer_set_current_capture(rast, immediate);
+
+    framebuffer_clear(rast, &scene.fb, scene.clear);
+    render_arrays(rast, &scene.call);
+
+    // recorded, where clears may be deferred
+    capture_t* recorded = capture_new();
+    scene_make_stale(&scene);
+
+    rasterizer_begin_frame(rast);
+    rasterizer_set_current_capture(rast, recorded);
+
+    command_buffer_t* cmd = command_buffer_create();
+    command_buffer_clear(cmd, &scene.fb, scene.clear);
+    command_buffer_render_arrays(cmd, &scene.call);
+
+    fence_t* fence = fence_create(false);
+    rasterizer_submit(rast, cmd, fence);
+    fence_wait(fence);
+
+    rasterizer_set_current_capture(rast, NULL);
+    uint32_t differences = compare_captures(immediate, recorded);
+
+    fence_destroy(fence);
+    command_buffer_destroy(cmd);
+    capture_destroy(immediate);
+    capture_destroy(recorded);
+    scene_free(&scene);
+    rasterizer_destroy(rast);
+
+    return differences > 0 ? 1 : 0;
+}